@@ -0,0 +1,40 @@
+#ifndef SYSRING_DATA_H
+#define SYSRING_DATA_H
+
+#include <stdint.h>
+
+/*
+ * Layout of a task's syscall ring, shared by the kernel and userlib.
+ * The task queues syscalls in 'sq' and the kernel answers in 'cq', both
+ * single-producer / single-consumer rings with free-running 32-bit
+ * indices (slot = index % SYSRING_ENTRIES). Mapped read-write at
+ * SYSRING_BASE by SYS_RING_SETUP.
+ */
+#define SYSRING_BASE    0x00007FFFFFFE0000ULL
+#define SYSRING_ENTRIES 128             // Power of two
+#define SYSRING_MASK    (SYSRING_ENTRIES - 1)
+
+/* One queued syscall: 'op' is the sys_table index, args go to rdi/rsi/rdx */
+typedef struct sysring_sqe {
+    uint64_t op;
+    uint64_t arg[3];
+    uint64_t user_data;             // Copied into the completion
+} sysring_sqe_t;
+
+typedef struct sysring_cqe {
+    uint64_t user_data;
+    int64_t  res;                   // Syscall return value, -1 if refused
+} sysring_cqe_t;
+
+typedef struct sysring {
+    uint32_t sq_head;               // Kernel: next entry to run
+    uint32_t sq_tail;               // User: next free entry
+    uint32_t cq_head;               // User: next completion to read
+    uint32_t cq_tail;               // Kernel: next free completion
+    uint8_t  pad[48];
+
+    sysring_sqe_t sq[SYSRING_ENTRIES];
+    sysring_cqe_t cq[SYSRING_ENTRIES];
+} sysring_t;
+
+#endif
@@ -8,3 +8,115 @@ void u_printf(const char* fmt, ...) {
     va_end(args);
     u_print(buf);
 }
+
+/*
+ * MUTEX
+ * Three states, so an unlock only calls into the kernel when somebody may
+ * be sleeping. A task that had to sleep re-takes the lock as 2, because it
+ * cannot know whether others are still queued behind it.
+ */
+void u_mutex_lock(u_mutex_t* m) {
+    uint32_t c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+
+    if (c != 2) c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        u_futex_wait(&m->state, 2, 0);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+bool u_mutex_trylock(u_mutex_t* m) {
+    uint32_t c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void u_mutex_unlock(u_mutex_t* m) {
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        u_futex_wake(&m->state, 1);
+    }
+}
+
+/*
+ * CONDITION VARIABLE
+ * The waiter samples 'seq' before dropping the mutex, so a signal sent
+ * after the unlock changes the word and the futex wait returns at once.
+ * Spurious wakeups are possible; callers re-check their predicate.
+ */
+void u_cond_wait(u_cond_t* c, u_mutex_t* m) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+
+    u_mutex_unlock(m);
+    u_futex_wait(&c->seq, seq, 0);
+
+    // Others may be waking with us, take the mutex as contended
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        u_futex_wait(&m->state, 2, 0);
+    }
+}
+
+void u_cond_signal(u_cond_t* c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    u_futex_wake(&c->seq, 1);
+}
+
+void u_cond_broadcast(u_cond_t* c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    u_futex_wake(&c->seq, UINT32_MAX);
+}
+
+/*
+ * SEMAPHORE
+ * A post only enters the kernel if a waiter announced itself. Waiters
+ * sleep on count == 0, so a post that lands before the sleep makes the
+ * futex wait return immediately.
+ */
+bool u_sem_trywait(u_sem_t* s) {
+    uint32_t c = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    while (c > 0) {
+        if (__atomic_compare_exchange_n(&s->count, &c, c - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return true;
+    }
+    return false;
+}
+
+void u_sem_wait(u_sem_t* s) {
+    while (!u_sem_trywait(s)) {
+        __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        u_futex_wait(&s->count, 0, 0);
+        __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void u_sem_post(u_sem_t* s) {
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST)) u_futex_wake(&s->count, 1);
+}
+
+/*
+ * THREADS
+ * The kernel enters a new thread at u_thread_start with the u_thread_t in
+ * RDI. Join sleeps on 'done', so it costs nothing while the thread runs.
+ */
+static void u_thread_start(u_thread_t* th) {
+    th->fn(th->arg);
+
+    __atomic_store_n(&th->done, 1, __ATOMIC_RELEASE);
+    u_futex_wake(&th->done, UINT32_MAX);
+    u_exit();
+}
+
+int64_t u_thread_create(u_thread_t* th, void (*fn)(void*), void* arg, uintptr_t tls) {
+    th->done = 0;
+    th->fn   = fn;
+    th->arg  = arg;
+
+    int64_t tid = (int64_t)syscall_4(21, (uintptr_t)u_thread_start, (uintptr_t)th, 0, tls);
+    th->tid = tid < 0 ? 0 : (uint32_t)tid;
+    return tid;
+}
+
+void u_thread_join(u_thread_t* th) {
+    while (!__atomic_load_n(&th->done, __ATOMIC_ACQUIRE)) {
+        u_futex_wait(&th->done, 0, 0);
+    }
+}
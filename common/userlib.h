@@ -3,7 +3,10 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <io.h>
+#include <vdso_data.h>
+#include <sysring_data.h>
 
 /* 
  * General helper for Syscalls
@@ -19,6 +22,19 @@ static uint64_t syscall_3(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3) {
     return ret;
 }
 
+/* Same, with a fourth argument in R10 (RCX is taken by SYSCALL) */
+static uint64_t syscall_4(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4) {
+    uint64_t ret;
+    register uint64_t r10 __asm__("r10") = a4;
+    __asm__ volatile (
+        "syscall"
+        : "=a"(ret)
+        : "a"(num), "D"(a1), "S"(a2), "d"(a3), "r"(r10)
+        : "rcx", "r11", "memory"
+    );
+    return ret;
+}
+
 /* Main printing function for user */
 void u_printf(const char* fmt, ...);
 
@@ -33,8 +49,56 @@ static inline void u_exit(void) {
     syscall_3(2, 0, 0, 0);
 }
 
+/*
+ * VDSO READERS
+ * The kernel keeps the clock, the CPU count and the task running on each
+ * CPU in a read-only page at VDSO_BASE, so these calls are plain loads.
+ * Each falls back to its syscall when the page cannot answer.
+ */
+#define U_VDSO ((const volatile vdso_data_t*)VDSO_BASE)
+
+/* Id of the CPU running the caller, from TSC_AUX. Needs VDSO_RDTSCP. */
+static inline uint32_t u_vdso_cpu(uint32_t flags) {
+    if (flags & VDSO_RDPID) {
+        uint64_t id;
+        __asm__ volatile("rdpid %0" : "=r"(id));
+        return (uint32_t)id;
+    }
+
+    uint32_t low, high, aux;
+    __asm__ volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+    return aux;
+}
+
+/* Milliseconds since timer calibration, same clock as the kernel's */
 static inline uint64_t u_get_uptime(void) {
-    return syscall_3(3, 0, 0, 0);
+    const volatile vdso_data_t* v = U_VDSO;
+
+    for (;;) {
+        uint32_t seq = v->seq;
+        __asm__ volatile("" ::: "memory");
+        if (seq & 1) continue;
+
+        uint64_t mult = v->mult;
+        if (!mult) return syscall_3(3, 0, 0, 0);
+
+        uint64_t tsc;
+        uint32_t low, high, aux;
+        if (v->flags & VDSO_RDTSCP) {
+            __asm__ volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+            tsc = (((uint64_t)high << 32) | low) + v->offset[aux % VDSO_MAX_CPUS];
+        } else {
+            __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+            tsc = ((uint64_t)high << 32) | low;
+        }
+        int64_t delta = (int64_t)(tsc - v->tsc_base);
+
+        __asm__ volatile("" ::: "memory");
+        if (v->seq != seq) continue;
+
+        if (delta < 0) return 0;
+        return (uint64_t)(((unsigned __int128)delta * mult) >> VDSO_SHIFT) / 1000000;
+    }
 }
 
 static inline void u_sleep(uint64_t ms) {
@@ -54,7 +118,10 @@ static inline void u_print_hex(uint64_t val) {
 }
 
 static inline uint64_t u_get_cpuid(void) {
-    return syscall_3(8, 0, 0, 0);
+    uint32_t flags = U_VDSO->flags;
+    if (!(flags & VDSO_RDTSCP)) return syscall_3(8, 0, 0, 0);
+
+    return u_vdso_cpu(flags);
 }
 
 static inline uint64_t u_sys_malloc(size_t size) {
@@ -65,12 +132,200 @@ static inline void u_sys_free(uint64_t ptr, size_t size) {
     syscall_3(10, ptr, size, 0);
 }
 
+/*
+ * The slot of the caller's CPU names the running task. If the slot's 'seq'
+ * and the CPU id are the same after reading it, no switch happened on that
+ * CPU in between, so the caller was the task it names.
+ */
 static inline uint32_t u_sys_get_tid() {
-    return syscall_3(11, 0, 0, 0);
+    const volatile vdso_data_t* v = U_VDSO;
+    uint32_t flags = v->flags;
+    if (!(flags & VDSO_RDTSCP)) return syscall_3(11, 0, 0, 0);
+
+    for (;;) {
+        uint32_t cpu = u_vdso_cpu(flags);
+        if (cpu >= VDSO_MAX_CPUS) return syscall_3(11, 0, 0, 0);
+
+        uint32_t seq = v->cpu[cpu].seq;
+        __asm__ volatile("" ::: "memory");
+        uint32_t tid = v->cpu[cpu].tid;
+        __asm__ volatile("" ::: "memory");
+
+        if (u_vdso_cpu(flags) == cpu && v->cpu[cpu].seq == seq) return tid;
+    }
 }
 
 static inline uint8_t u_sys_cpu_count() {
-    return (uint8_t)syscall_3(12, 0, 0, 0);
+    uint32_t count = U_VDSO->cpu_count;
+    if (!count) return (uint8_t)syscall_3(12, 0, 0, 0);
+
+    return (uint8_t)count;
+}
+
+/* Returns the child TID in the parent, 0 in the child, -1 on failure */
+static inline int64_t u_fork(void) {
+    return (int64_t)syscall_3(13, 0, 0, 0);
+}
+
+/*
+ * Restricts task 'tid' (0 = self) to the CPUs set in 'mask': bit n of
+ * word n / 64 is CPU n, 'size' is the mask size in bytes. Returns 0, or
+ * -1 if the task does not exist or no CPU in the mask is online.
+ */
+static inline int64_t u_sched_setaffinity(uint64_t tid, const uint64_t* mask, size_t size) {
+    return (int64_t)syscall_3(14, tid, (uintptr_t)mask, size);
+}
+
+/* Scheduling classes for u_sched_setpolicy() */
+#define U_SCHED_MLFQ    0   // Fixed priority levels (default)
+#define U_SCHED_FAIR    1   // CPU time shared by weight, set by 'nice' (-20..19)
+
+/* Moves task 'tid' (0 = self) to class 'policy'. Returns 0 or -1. */
+static inline int64_t u_sched_setpolicy(uint64_t tid, uint64_t policy, int64_t nice) {
+    return (int64_t)syscall_3(15, tid, policy, (uint64_t)nice);
+}
+
+/*
+ * Makes task 'tid' (0 = self) real-time: 'runtime_ms' of CPU every
+ * 'period_ms', ahead of every other class. Fails (-1) if no allowed CPU
+ * has that much real-time bandwidth left. runtime_ms = 0 leaves the class.
+ */
+static inline int64_t u_sched_setdeadline(uint64_t tid, uint64_t runtime_ms, uint64_t period_ms) {
+    return (int64_t)syscall_3(16, tid, runtime_ms, period_ms);
+}
+
+/*
+ * SYSCALL RING
+ * Queue syscalls with u_ring_submit(), run the whole batch with one
+ * u_ring_enter(), then collect results with u_ring_reap(). Exit, fork
+ * and the ring calls themselves complete with -1.
+ */
+
+/* Maps the caller's ring. Returns it, or NULL. */
+static inline sysring_t* u_ring_setup(void) {
+    int64_t ret = (int64_t)syscall_3(17, 0, 0, 0);
+    return ret == -1 ? NULL : (sysring_t*)ret;
+}
+
+/* Runs every queued entry. Returns how many were consumed. */
+static inline int64_t u_ring_enter(void) {
+    return (int64_t)syscall_3(18, 0, 0, 0);
+}
+
+/* Queues syscall 'op'. Returns 0, or -1 if the submission queue is full. */
+static inline int u_ring_submit(sysring_t* ring, uint64_t op, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t user_data) {
+    uint32_t tail = ring->sq_tail;
+    if (tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) >= SYSRING_ENTRIES) return -1;
+
+    sysring_sqe_t* sqe = &ring->sq[tail & SYSRING_MASK];
+    sqe->op        = op;
+    sqe->arg[0]    = a1;
+    sqe->arg[1]    = a2;
+    sqe->arg[2]    = a3;
+    sqe->user_data = user_data;
+
+    __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Takes the oldest completion. Returns 1, or 0 if there is none. */
+static inline int u_ring_reap(sysring_t* ring, sysring_cqe_t* out) {
+    uint32_t head = ring->cq_head;
+    if (head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+
+    *out = ring->cq[head & SYSRING_MASK];
+    __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * FUTEX
+ * Tasks sleep on a 32-bit word in memory; the kernel only keeps the queue.
+ * Private words are matched by address space and virtual address, so
+ * threads meet on them but a forked parent and child do not, even while
+ * they still share the copy-on-write frame. Only words in shared mappings
+ * (VMA_SHARED) are matched by frame.
+ */
+#define U_FUTEX_WOKEN       0
+#define U_FUTEX_EAGAIN     -1   // Word did not hold 'val'
+#define U_FUTEX_ETIMEDOUT  -2
+#define U_FUTEX_EFAULT     -3
+
+/* Sleeps while *addr == val, at most 'timeout_ms' (0 = no limit) */
+static inline int64_t u_futex_wait(volatile uint32_t* addr, uint32_t val, uint64_t timeout_ms) {
+    return (int64_t)syscall_3(19, (uintptr_t)addr, val, timeout_ms);
+}
+
+/* Wakes up to 'count' sleepers on 'addr'. Returns how many woke. */
+static inline int64_t u_futex_wake(volatile uint32_t* addr, uint32_t count) {
+    return (int64_t)syscall_3(20, (uintptr_t)addr, count, 0);
+}
+
+/*
+ * SYNCHRONISATION (userlib.c)
+ * Built on futexes: the uncontended paths are a single atomic operation
+ * and never enter the kernel.
+ */
+typedef struct u_mutex {
+    volatile uint32_t state;    // 0 free, 1 locked, 2 locked with sleepers
+} u_mutex_t;
+
+typedef struct u_cond {
+    volatile uint32_t seq;      // Bumped by every signal/broadcast
+} u_cond_t;
+
+typedef struct u_sem {
+    volatile uint32_t count;
+    volatile uint32_t waiters;  // Tasks inside u_sem_wait() that found it empty
+} u_sem_t;
+
+#define U_MUTEX_INIT    { 0 }
+#define U_COND_INIT     { 0 }
+#define U_SEM_INIT(n)   { (n), 0 }
+
+void u_mutex_lock(u_mutex_t* m);
+bool u_mutex_trylock(u_mutex_t* m);
+void u_mutex_unlock(u_mutex_t* m);
+
+void u_cond_wait(u_cond_t* c, u_mutex_t* m);
+void u_cond_signal(u_cond_t* c);
+void u_cond_broadcast(u_cond_t* c);
+
+void u_sem_wait(u_sem_t* s);
+bool u_sem_trywait(u_sem_t* s);
+void u_sem_post(u_sem_t* s);
+
+/*
+ * THREADS (userlib.c)
+ * A thread shares the whole address space of its creator and gets its own
+ * stack. 'tls' becomes its FS base (0 = none). The u_thread_t must stay
+ * valid until u_thread_join() returns.
+ */
+typedef struct u_thread {
+    volatile uint32_t done;     // Set to 1 when fn returns, futex for join
+    uint32_t tid;
+    void (*fn)(void*);
+    void* arg;
+} u_thread_t;
+
+int64_t u_thread_create(u_thread_t* th, void (*fn)(void*), void* arg, uintptr_t tls);
+void u_thread_join(u_thread_t* th);
+
+/* Sets the caller's FS base */
+static inline int64_t u_set_tls(uintptr_t base) {
+    return (int64_t)syscall_3(22, base, 0, 0);
+}
+
+/* 0: syscalls on this CPU return with iretq only, 1: sysretq (default) */
+static inline void u_set_sysret(uint64_t on) {
+    syscall_3(23, on, 0, 0);
+}
+
+/* Raw TSC, for timing from Ring 3 */
+static inline uint64_t u_rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile("lfence; rdtsc" : "=a"(low), "=d"(high) :: "memory");
+    return ((uint64_t)high << 32) | low;
 }
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef VDSO_DATA_H
+#define VDSO_DATA_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the vDSO page, shared by the kernel (writer) and userlib
+ * (reader). One physical page, mapped read-only at VDSO_BASE in every
+ * user address space. Holds no pointers, only values.
+ */
+#define VDSO_BASE       0x00007FFFFFFF0000ULL
+#define VDSO_MAX_CPUS   32
+#define VDSO_SHIFT      32          // ns = ((tsc - tsc_base) * mult) >> VDSO_SHIFT
+
+/* Feature bits in vdso_data_t.flags */
+#define VDSO_RDTSCP     (1 << 0)    // TSC_AUX holds the CPU id, read with RDTSCP
+#define VDSO_RDPID      (1 << 1)    // Same id, read with RDPID
+
+/* Task running on one CPU. 'seq' moves on every switch on that CPU. */
+typedef struct vdso_cpu {
+    uint32_t seq;
+    uint32_t tid;
+} __attribute__((aligned(64))) vdso_cpu_t;
+
+typedef struct vdso_data {
+    // Clock, written under 'seq' (odd while an update is in progress)
+    uint32_t seq;
+    uint32_t flags;
+    uint64_t tsc_base;
+    uint64_t mult;                          // 0 until the TSC is calibrated
+    int64_t  offset[VDSO_MAX_CPUS];         // Added to a CPU's TSC to get BSP time
+    uint32_t cpu_count;
+
+    vdso_cpu_t cpu[VDSO_MAX_CPUS];
+} vdso_data_t;
+
+#endif
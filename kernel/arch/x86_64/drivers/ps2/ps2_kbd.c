@@ -4,8 +4,10 @@
 #include <serial.h>
 #include <atomic.h>
 #include <sched.h>
+#include <wait_queue.h>
 
 static spinlock_t kbd_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };
+wait_queue_t kbd_wait_queue = WAIT_QUEUE_INIT;
 
 // Handler section
 static int is_caps     = 0;
@@ -47,7 +49,7 @@ void ps2_keyboard_handler() {
             uint8_t ascii = use_upper ? scancode_set2_upper[scancode] : scancode_set2_lower[scancode];
             if (ascii != 0) {
                 kbd_push_char(ascii);
-                sched_wakeup(REASON_KEYBOARD);
+                wake_up_one(&kbd_wait_queue);
             }
         }
         is_extended = 0; // Ensure extended state is cleared after processing
@@ -88,3 +90,10 @@ bool kbd_pop_char(char* out_char) {
     spin_irq_restore(f);
     return true;
 }
+
+/*
+ * Lock-free peek used as a wait condition
+ */
+bool kbd_has_char() {
+    return kbd_head != kbd_tail;
+}
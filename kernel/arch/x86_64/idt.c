@@ -5,6 +5,9 @@
 #include <timer.h>
 #include <panic.h>
 #include <sched.h>
+#include <timer_wheel.h>
+#include <vma.h>
+#include <tlb.h>
 #include <atomic.h>
 #include <ps2_kbd.h>
 
@@ -38,6 +41,21 @@ void exception_handler(interrupt_frame_t* frame) {
     panic("Unhandled CPU Exception");  // !!! WILL BE CHANGED !!!
 }
 
+/*
+ * Page fault (#PF, vector 14) entry point.
+ * Gives the VMA layer a chance to back the page on demand before
+ * treating the fault as fatal. Returns 0 if the fault was resolved.
+ */
+static int page_fault_handler(interrupt_frame_t* frame) {
+    uint64_t cr2;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+
+    cpu_context_t* cpu = get_cpu();
+    if (!cpu || !cpu->current_task) return -1;
+
+    return vma_handle_fault(cpu->current_task, cr2, frame->error_code);
+}
+
 void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags) {
     uintptr_t addr = (uintptr_t)isr;
     idt[vector].isr_low    = addr & 0xFFFF;
@@ -52,19 +70,27 @@ void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags) {
 uint64_t interrupt_dispatch(interrupt_frame_t* frame) {
     uint64_t next_rsp = (uint64_t)frame;
 
-    if (frame->vector_number < 32) {
+    if (frame->vector_number == 14) {
+        if (page_fault_handler(frame) != 0) exception_handler(frame);
+    } else if (frame->vector_number < 32) {
         exception_handler(frame);
     } else if (frame->vector_number == 32) {
-        if (get_cpu()->cpu_id == 0)
-        system_uptime_ms += 5; // BSP only
-        
-        sched_update_sleepers();
+        timer_wheel_run();
         lapic_send_eoi();
         
         next_rsp = schedule(frame);
     } else if (frame->vector_number == 33) {
         ps2_keyboard_handler();
         lapic_send_eoi();
+    } else if (frame->vector_number == IPI_VECTOR_RESCHED) {
+        // Clear first: a wakeup that lands during schedule() sends a new IPI
+        __atomic_store_n(&get_cpu()->resched_ipi_pending, false, __ATOMIC_RELEASE);
+        lapic_send_eoi();
+
+        next_rsp = schedule(frame);
+    } else if (frame->vector_number == IPI_VECTOR_TLB) {
+        tlb_shootdown_service();
+        lapic_send_eoi();
     } else if (frame->vector_number == IPI_VECTOR_TEST) {
         // Flush TLB
         cpu_flush_tlb();
@@ -76,6 +102,11 @@ uint64_t interrupt_dispatch(interrupt_frame_t* frame) {
         lapic_send_eoi();
     }
 
+    // A wakeup on this CPU asked for a reschedule (sched_resched_cpu)
+    if (frame->vector_number >= 32 && next_rsp == (uint64_t)frame && get_cpu()->need_resched) {
+        next_rsp = schedule(frame);
+    }
+
     return next_rsp;
 }
 
@@ -1,5 +1,6 @@
 [bits 64]
 extern interrupt_dispatch
+extern sched_switch_done
 global isr_stub_table
 
 section .text
@@ -51,8 +52,13 @@ common_stub:
 .no_swap_in:
 
     mov rdi, rsp
+    mov rbx, rsp               ; Callee-saved, restored from the frame below
     call interrupt_dispatch
     mov rsp, rax
+    cmp rax, rbx
+    je .no_switch
+    call sched_switch_done     ; The old task's stack is free from here on
+.no_switch:
 
     test qword [rsp + 144], 3
     jz .no_swap_out
@@ -3,11 +3,13 @@
 #include <vmm.h>
 #include <idt.h>
 #include <kmalloc.h>
+#include <slab.h>
 #include <atomic.h>
 #include <std_funcs.h>
 #include <cpu.h>
 #include <elf.h>
 #include <vma.h>
+#include <vdso.h>
 
 #include <stddef.h>
 
@@ -18,24 +20,32 @@ static uint64_t next_tid = 10;  // Start TIDs for user/test tasks at 10
  * Internal helpers to avoid boilerplate
  */
 static task_t* task_alloc_base() {
-    task_t* t = kmalloc(sizeof(task_t));
+    task_t* t = kmem_cache_alloc(task_cache);
     if (!t) return NULL;
 
-    memset(t, 0, sizeof(task_t));
-
     vma_init_task(t);
 
     t->stack_size = 4 * PAGE_SIZE;
     t->stack_base = (uintptr_t)kmalloc(t->stack_size);
-    if (!t->stack_base) { kfree(t); return NULL; }
+    if (!t->stack_base) { kmem_cache_free(task_cache, t); return NULL; }
 
     memset((void*)t->stack_base, 0, t->stack_size);
 
     t->cpu_id = -1;
+    cpumask_fill(&t->affinity);
     t->state = TASK_READY;
+    t->state_lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+    t->on_rq  = true;
+    t->on_cpu = false;
     t->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
     t->priority = PRIO_NORMAL;
     t->base_priority = PRIO_NORMAL;
+    t->policy = SCHED_POLICY_MLFQ;
+    t->policy_next = SCHED_POLICY_MLFQ;
+    t->ustack_base = 0;
+    t->fs_base = 0;
+    fair_init_task(t, 0);
+    rt_init_task(t);
 
     return t;
 }
@@ -60,7 +70,25 @@ static void task_register(task_t* t) {
     spin_irq_restore(f);
     
     t->cpu_id = (uint64_t)-1;
-    enqueue_task(get_cpu(), t);
+    enqueue_task(sched_select_cpu(t, get_cpu()), t);
+}
+
+/* Scheduling parameters a forked process or a new thread takes from its creator */
+static void task_inherit_sched(task_t* t, task_t* parent) {
+    t->priority      = parent->base_priority;
+    t->base_priority = parent->base_priority;
+    t->affinity      = parent->affinity;
+    t->policy        = parent->policy;
+    t->policy_next   = parent->policy_next;
+    fair_init_task(t, parent->fair.nice);
+
+    // Real-time bandwidth is not inherited: the child of a real-time task starts in MLFQ
+    if (t->policy == SCHED_POLICY_RT || t->policy_next == SCHED_POLICY_RT) {
+        t->policy        = SCHED_POLICY_MLFQ;
+        t->policy_next   = SCHED_POLICY_MLFQ;
+        t->priority      = PRIO_NORMAL;
+        t->base_priority = PRIO_NORMAL;
+    }
 }
 
 /*
@@ -76,7 +104,7 @@ task_t* arch_task_create(void (*entry_point)(void)) {
     t->priority = PRIO_HIGH;
     t->base_priority = PRIO_HIGH;
     t->is_user  = false;
-    t->cr3      = read_cr3();
+    t->cr3      = read_cr3() & ~CR3_PCID_MASK;
 
     uintptr_t stack_top = (t->stack_base + t->stack_size) & ~0x0FULL;
     
@@ -108,30 +136,36 @@ task_t* arch_task_create_user(void (*entry_point)(void)) {
     if (!t) return NULL;
 
     uintptr_t cr3 = vmm_create_user_pml4();
-    if (!cr3) { kfree((void*)t->stack_base); kfree(t); return NULL; }
+    if (!cr3) { kfree((void*)t->stack_base); kmem_cache_free(task_cache, t); return NULL; }
+    t->mm = mm_create(cr3);
+    if (!t->mm) { vmm_destroy_user_pml4(cr3, false); kfree((void*)t->stack_base); kmem_cache_free(task_cache, t); return NULL; }
     t->cr3 = cr3;
     t->is_user = true;
 
-    // 1. Map User Code via VMA (Allocates physical memory and registers it)
+    // 1. Reserve User Code via VMA
     uintptr_t code_virt = 0x400000;
     uint64_t code_size  = 4 * PAGE_SIZE;
     if (vma_map(t, code_virt, code_size, VMA_READ | VMA_EXEC | VMA_USER) != 0) return NULL;
 
-    // Copy the code from entry_point to the newly allocated physical pages
-    uintptr_t code_phys = vmm_virtual_to_physical(vmm_get_table(cr3), code_virt);
-    memcpy((void*)phys_to_virt(code_phys), (void*)entry_point, code_size);
+    // Copy the code from entry_point page by page, frames are populated on demand
+    for (uint64_t off = 0; off < code_size; off += PAGE_SIZE) {
+        uintptr_t code_phys = vma_get_page(t, code_virt + off);
+        if (!code_phys) return NULL;
+        memcpy((void*)phys_to_virt(code_phys), (uint8_t*)entry_point + off, PAGE_SIZE);
+    }
 
     // 2. Map User Stack and Heap via VMA
     uintptr_t u_stack_virt = 0x00007FFFFFFFF000 - (4 * PAGE_SIZE);
     uint64_t u_stack_size  = 4 * PAGE_SIZE;
     if (vma_map(t, u_stack_virt, u_stack_size, VMA_READ | VMA_WRITE | VMA_USER | VMA_STACK) != 0) return NULL;
+    if (vdso_map(t) != 0) return NULL;
 
     // 3. Initialize Heap Pointers and map the Heap
-    t->heap_start = 0x406000;
-    t->heap_curr  = t->heap_start;
-    t->heap_end   = t->heap_start + 4 * PAGE_SIZE;
+    t->mm->heap_start = 0x406000;
+    t->mm->heap_curr  = t->mm->heap_start;
+    t->mm->heap_end   = t->mm->heap_start + 4 * PAGE_SIZE;
 
-    if (vma_map(t, t->heap_start, 4 * PAGE_SIZE, VMA_READ | VMA_WRITE | VMA_USER | VMA_HEAP) != 0) return NULL;
+    if (vma_map(t, t->mm->heap_start, 4 * PAGE_SIZE, VMA_READ | VMA_WRITE | VMA_USER | VMA_HEAP) != 0) return NULL;
 
     // Setup the interrupt frame for Ring 3 transition (iretq)
     uintptr_t kstack_top = (t->stack_base + t->stack_size) & ~0x0FULL; 
@@ -139,8 +173,8 @@ task_t* arch_task_create_user(void (*entry_point)(void)) {
     memset(frame, 0, sizeof(interrupt_frame_t));
 
     frame->rip    = code_virt;
-    frame->cs     = 0x1B; // User Code Selector (RPL 3)
-    frame->ss     = 0x23; // User Data Selector (RPL 3)
+    frame->cs     = 0x23; // User Code Selector (RPL 3)
+    frame->ss     = 0x1B; // User Data Selector (RPL 3)
     frame->rflags = 0x202; 
     frame->rsp    = u_stack_virt + u_stack_size - 8;
     frame->rbp    = frame->rsp;
@@ -159,7 +193,9 @@ task_t* arch_task_spawn_elf(void* elf_raw_data) {
     if (!t) return NULL;
 
     uintptr_t cr3 = vmm_create_user_pml4();
-    if (!cr3) { kfree((void*)t->stack_base); kfree(t); return NULL; }
+    if (!cr3) { kfree((void*)t->stack_base); kmem_cache_free(task_cache, t); return NULL; }
+    t->mm = mm_create(cr3);
+    if (!t->mm) { vmm_destroy_user_pml4(cr3, false); kfree((void*)t->stack_base); kmem_cache_free(task_cache, t); return NULL; }
     t->cr3 = cr3;
     t->is_user = true;
 
@@ -171,6 +207,7 @@ task_t* arch_task_spawn_elf(void* elf_raw_data) {
     uintptr_t u_stack_virt = 0x00007FFFFFFFF000 - (4 * PAGE_SIZE);
     uint64_t u_stack_size  = 4 * PAGE_SIZE;
     if (vma_map(t, u_stack_virt, u_stack_size, VMA_READ | VMA_WRITE | VMA_USER | VMA_STACK) != 0) return NULL;
+    if (vdso_map(t) != 0) return NULL;
 
     // 3. Setup Kernel Stack Frame
     uintptr_t kstack_top = (t->stack_base + t->stack_size) & ~0x0FULL;
@@ -178,8 +215,8 @@ task_t* arch_task_spawn_elf(void* elf_raw_data) {
     memset(frame, 0, sizeof(interrupt_frame_t));
 
     frame->rip    = entry;
-    frame->cs     = 0x1B;
-    frame->ss     = 0x23;
+    frame->cs     = 0x23;
+    frame->ss     = 0x1B;
     frame->rflags = 0x202;
     frame->rsp    = u_stack_virt + u_stack_size - 8;
     frame->rbp    = frame->rsp;
@@ -189,3 +226,107 @@ task_t* arch_task_spawn_elf(void* elf_raw_data) {
 
     return t;
 }
+
+/*
+ * Duplicates the calling user task (fork).
+ * The child gets a copy-on-write view of the parent's address space and a copy
+ * of its syscall frame, so it resumes at the same instruction with RAX = 0.
+ */
+task_t* arch_task_fork(interrupt_frame_t* parent_frame) {
+    task_t* parent = sched_get_current();
+    if (!parent || !parent->is_user) return NULL;
+
+    task_t* t = task_alloc_base();
+    if (!t) return NULL;
+
+    uintptr_t cr3 = vmm_create_user_pml4();
+    if (!cr3) { kfree((void*)t->stack_base); kmem_cache_free(task_cache, t); return NULL; }
+    t->mm = mm_create(cr3);
+    if (!t->mm) { vmm_destroy_user_pml4(cr3, false); kfree((void*)t->stack_base); kmem_cache_free(task_cache, t); return NULL; }
+    t->cr3 = cr3;
+    t->is_user = true;
+
+    task_inherit_sched(t, parent);
+    t->fs_base       = parent->fs_base;
+    t->ustack_base   = parent->ustack_base;
+    t->mm->heap_start = parent->mm->heap_start;
+    t->mm->heap_curr  = parent->mm->heap_curr;
+    t->mm->heap_end   = parent->mm->heap_end;
+    t->mm->has_ring   = parent->mm->has_ring;   // Private copy-on-write copy of the ring
+
+    // 1. Share every populated user page copy-on-write
+    if (vma_fork(parent, t) != 0) {
+        vma_destroy_all(t);
+        kfree((void*)t->stack_base);
+        kmem_cache_free(task_cache, t);
+        return NULL;
+    }
+
+    // 2. Clone the syscall frame, the child sees fork() return 0
+    uintptr_t kstack_top = (t->stack_base + t->stack_size) & ~0x0FULL;
+    interrupt_frame_t* frame = (interrupt_frame_t*)(kstack_top - sizeof(interrupt_frame_t));
+    memcpy(frame, parent_frame, sizeof(interrupt_frame_t));
+    frame->rax = 0;
+
+    t->rsp = (uintptr_t)frame;
+    task_register(t);
+
+    return t;
+}
+
+/*
+ * Starts a new thread in the calling user task's address space.
+ * The thread shares the caller's mm (one more reference), so memory, heap
+ * and ring are common; it only gets its own kernel stack, a user stack from
+ * the first free slot below THREAD_STACK_TOP and its own FS base (TLS).
+ * It enters at 'entry' with RDI = arg0 and RSI = arg1.
+ */
+task_t* arch_task_thread(uintptr_t entry, uint64_t arg0, uint64_t arg1, uintptr_t tls) {
+    task_t* parent = sched_get_current();
+    if (!parent || !parent->is_user || !parent->mm) return NULL;
+
+    task_t* t = task_alloc_base();
+    if (!t) return NULL;
+
+    mm_get(parent->mm);
+    t->mm      = parent->mm;
+    t->cr3     = parent->mm->cr3;
+    t->is_user = true;
+    t->fs_base = tls;
+    task_inherit_sched(t, parent);
+
+    // 1. User stack, slots keep a one-page guard gap between each other
+    for (uint64_t i = 0; i < THREAD_STACK_SLOTS; i++) {
+        uintptr_t base = THREAD_STACK_TOP - (i + 1) * (THREAD_STACK_SIZE + PAGE_SIZE) + PAGE_SIZE;
+        if (vma_map(t, base, THREAD_STACK_SIZE, VMA_READ | VMA_WRITE | VMA_USER | VMA_STACK) == 0) {
+            t->ustack_base = base;
+            break;
+        }
+    }
+
+    if (!t->ustack_base) {
+        vma_destroy_all(t);
+        kfree((void*)t->stack_base);
+        kmem_cache_free(task_cache, t);
+        return NULL;
+    }
+
+    // 2. Ring 3 entry frame
+    uintptr_t kstack_top = (t->stack_base + t->stack_size) & ~0x0FULL;
+    interrupt_frame_t* frame = (interrupt_frame_t*)(kstack_top - sizeof(interrupt_frame_t));
+    memset(frame, 0, sizeof(interrupt_frame_t));
+
+    frame->rip    = entry;
+    frame->cs     = 0x23;
+    frame->ss     = 0x1B;
+    frame->rflags = 0x202;
+    frame->rsp    = t->ustack_base + THREAD_STACK_SIZE - 8;
+    frame->rbp    = frame->rsp;
+    frame->rdi    = arg0;
+    frame->rsi    = arg1;
+
+    t->rsp = (uintptr_t)frame;
+    task_register(t);
+
+    return t;
+}
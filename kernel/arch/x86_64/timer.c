@@ -1,8 +1,15 @@
 #include <timer.h>
 #include <cpu.h>
 #include <sched.h>
+#include <serial.h>
+#include <vdso.h>
 
-volatile uint64_t system_uptime_ms = 0;
+clocksource_t clocksource = { 0 };
+
+// BSP <-> AP rendezvous for TSC offset measurement
+static volatile uint64_t tsc_sync_request  = 0;   // Round the AP is waiting on
+static volatile uint64_t tsc_sync_response = 0;   // Round the BSP has answered
+static volatile uint64_t tsc_sync_value    = 0;   // BSP TSC for that round
 
 /* global spinlock flag */
 extern int g_lock_enabled;
@@ -24,3 +31,102 @@ void msleep(uint64_t ms) {
     sched_make_task_sleep(ms);
     sched_yield();
 }
+
+/*
+ * Fills the clocksource from the PIT-measured TSC window (BSP only).
+ * Detects invariant TSC (CPUID 0x80000007 EDX[8]) and RDTSCP
+ * (CPUID 0x80000001 EDX[27]); without RDTSCP every CPU is assumed to
+ * share the BSP's counter.
+ */
+void clocksource_init(uint64_t tsc_start, uint64_t tsc_end, uint32_t window_ms) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_ext = eax;
+
+    if (max_ext >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        clocksource.rdtscp = (edx >> 27) & 1;
+    }
+    if (max_ext >= 0x80000007) {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        clocksource.invariant = (edx >> 8) & 1;
+    }
+
+    clocksource.tsc_per_ms = (tsc_end - tsc_start) / window_ms;
+    clocksource.tsc_base   = tsc_end;
+    clocksource_init_cpu(0);
+
+    // Publish mult last: it is what readers test for "calibrated"
+    __atomic_store_n(&clocksource.mult,
+                     (1000000ULL << CLOCK_SHIFT) / clocksource.tsc_per_ms,
+                     __ATOMIC_RELEASE);
+    vdso_update();
+
+    if (!clocksource.invariant) {
+        kprintf("[TIMER] WARNING: TSC is not invariant, time may drift in deep C-states\n");
+    }
+}
+
+/*
+ * Tags this CPU's RDTSCP results with its id.
+ */
+void clocksource_init_cpu(uint64_t cpu_id) {
+    if (clocksource.rdtscp) write_msr(MSR_TSC_AUX, cpu_id);
+}
+
+static inline uint64_t rdtsc_ordered() {
+    __asm__ volatile("lfence" ::: "memory");
+    return rdtsc();
+}
+
+/*
+ * BSP half of the TSC sync: answers TSC_SYNC_ROUNDS requests from the AP
+ * that is being brought up, each with a fresh reading of its own TSC.
+ */
+void tsc_sync_source() {
+    if (!clocksource.rdtscp) return;
+
+    uint64_t f = spin_irq_save();
+    for (uint64_t round = 1; round <= TSC_SYNC_ROUNDS; round++) {
+        while (tsc_sync_request != round) __asm__ volatile("pause");
+
+        tsc_sync_value = rdtsc_ordered();
+        __atomic_store_n(&tsc_sync_response, round, __ATOMIC_RELEASE);
+    }
+
+    tsc_sync_request  = 0;
+    tsc_sync_response = 0;
+    spin_irq_restore(f);
+}
+
+/*
+ * AP half of the TSC sync. Each round timestamps a request/response trip;
+ * the BSP's reading is assumed to sit in the middle of the fastest trip,
+ * which bounds the offset error by half that round trip.
+ */
+void tsc_sync_target(uint64_t cpu_id) {
+    clocksource_init_cpu(cpu_id);
+    if (!clocksource.rdtscp || cpu_id >= CLOCK_MAX_CPUS) return;
+
+    uint64_t best_rtt = (uint64_t)-1;
+    int64_t  offset   = 0;
+
+    for (uint64_t round = 1; round <= TSC_SYNC_ROUNDS; round++) {
+        uint64_t t0 = rdtsc_ordered();
+        __atomic_store_n(&tsc_sync_request, round, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&tsc_sync_response, __ATOMIC_ACQUIRE) != round) {
+            __asm__ volatile("pause");
+        }
+        uint64_t t1 = rdtsc_ordered();
+
+        if (t1 - t0 < best_rtt) {
+            best_rtt = t1 - t0;
+            offset = (int64_t)(tsc_sync_value - (t0 + (t1 - t0) / 2));
+        }
+    }
+
+    clocksource.offset[cpu_id] = offset;
+    vdso_update();
+}
@@ -2,6 +2,7 @@
 #include <cpu.h>
 #include <sched.h>
 #include <sched_utils.h>
+#include <wait_queue.h>
 
 /*
  * SPINLOCK
@@ -56,54 +57,42 @@ void mutex_lock(mutex_t* m) {
 
     while (1) {
         uint64_t f = spin_irq_save();
-        spin_lock(&m->wait_lock);
+        spin_lock(&m->waiters.lock);
 
         if (m->count > 0) {
             m->count = 0;
             m->owner = current;
 
-            spin_unlock(&m->wait_lock);
+            spin_unlock(&m->waiters.lock);
             spin_irq_restore(f);
             return;
         }
 
-        current->state = TASK_BLOCKED;
-        current->wait_reason = REASON_MUTEX;
+        wait_queue_add_locked(&m->waiters, current);
 
-        current->sched_next = m->wait_list;
-        m->wait_list = current;
-
-        spin_unlock(&m->wait_lock);
+        spin_unlock(&m->waiters.lock);
         spin_irq_restore(f);
 
         sched_yield();
     }
 }
 
+/*
+ * Releases the mutex and wakes the oldest waiter, which then competes for
+ * it again in mutex_lock.
+ */
 void mutex_unlock(mutex_t* m) {
     if (!g_lock_enabled) return;
 
     uint64_t f = spin_irq_save();
-    spin_lock(&m->wait_lock);
+    spin_lock(&m->waiters.lock);
 
     m->owner = NULL;
+    m->count = 1;
+    task_t* task_to_wake = wait_queue_pop_locked(&m->waiters);
 
-    task_t* task_to_wake = NULL;
+    spin_unlock(&m->waiters.lock);
 
-    if (m->wait_list) {
-        task_to_wake = m->wait_list;
-        m->wait_list = task_to_wake->sched_next;
-        task_to_wake->sched_next = NULL;
-    } else {
-        m->count = 1;
-    }
-
-    spin_unlock(&m->wait_lock);
+    if (task_to_wake) wait_queue_wake_task(task_to_wake);
     spin_irq_restore(f);
-
-    if (task_to_wake) {
-        task_to_wake->state = TASK_READY;
-        cpu_context_t* target_cpu = get_cpu_by_id(task_to_wake->cpu_id);
-        enqueue_task(target_cpu, task_to_wake);
-    }
 }
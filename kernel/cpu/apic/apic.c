@@ -4,6 +4,7 @@
 #include <apic.h>
 #include <serial.h>
 #include <panic.h>
+#include <timer.h>
 
 /* Pointer to the memory-mapped APIC registers */
 volatile uint32_t* lapic_base = NULL;
@@ -58,7 +59,8 @@ void lapic_init_ap() {
 /*
  * Calibrates the Local APIC timer frequency using the legacy PIT as a reference.
  * The BSP performs the actual measurement (10ms window), while APs wait for the result
- * to ensure synchronized timekeeping across all 32 cores.
+ * to ensure synchronized timekeeping across all 32 cores. The TSC is measured
+ * over the same window and becomes the system clocksource.
  */
 static cpu_context_t* lapic_timer_calibrate() {
     cpu_context_t* cpu = get_cpu();
@@ -70,9 +72,13 @@ static cpu_context_t* lapic_timer_calibrate() {
         lapic_write(LAPIC_TICR, 0xFFFFFFFF);
 
         pit_prepare_sleep(calibration_window_ms * 1193); 
+        uint64_t tsc_start = rdtsc();
         pit_wait_calibration();
 
         uint32_t current_ticks = lapic_read(LAPIC_TCCR);
+        uint64_t tsc_end = rdtsc();
+
+        clocksource_init(tsc_start, tsc_end, calibration_window_ms);
         global_ticks_per_ms = (0xFFFFFFFF - current_ticks) / calibration_window_ms;
         __asm__ volatile("mfence" ::: "memory");
     } else {
@@ -90,23 +96,64 @@ static cpu_context_t* lapic_timer_calibrate() {
 }
 
 /*
- * Enables the Local APIC timer in periodic mode for the current CPU.
- * Uses the pre-calculated calibration values to trigger interrupts 
- * at the specified millisecond interval on the given IDT vector.
+ * Enables the Local APIC timer for the current CPU in TSC-deadline mode when
+ * the CPU supports it, one-shot mode otherwise. Nothing is periodic: the first
+ * event fires after ms_interval, and from then on the scheduler programs each
+ * next event (or none at all) through lapic_timer_arm/lapic_timer_stop.
  */
 void lapic_timer_init(uint32_t ms_interval, uint8_t vector) {
     cpu_context_t* cpu = lapic_timer_calibrate();
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    cpu->timer_tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) && clocksource.tsc_per_ms;
     
-    // 1. Configure LVT Timer Register
-    // Bit 17: 1 for Periodic Mode, 0 for One-Shot
+    // 1. Set Divider to 16 (must match calibration)
+    lapic_write(LAPIC_TDCR, 0x03);
+
+    // 2. Configure LVT Timer Register
+    // Bits 17-18: timer mode
     // Bits 0-7: Interrupt Vector
-    lapic_write(LAPIC_LVT_TIMER, vector | (1 << 17));
+    if (cpu->timer_tsc_deadline) {
+        lapic_write(LAPIC_LVT_TIMER, vector | LAPIC_TIMER_TSC_DEADLINE);
+        // The LVT write must land before the first IA32_TSC_DEADLINE write
+        __asm__ volatile("mfence" ::: "memory");
+    } else {
+        lapic_write(LAPIC_LVT_TIMER, vector | LAPIC_TIMER_ONESHOT);
+    }
 
-    // 2. Set Divider to 16 (must match calibration)
-    lapic_write(LAPIC_TDCR, 0x03);
+    // 3. First event
+    lapic_timer_arm(ms_interval);
+}
 
-    // 3. Set Initial Count to the calculated ticks for the requested interval
-    lapic_write(LAPIC_TICR, cpu->lapic_ticks_per_ms * ms_interval);
+/*
+ * Programs the current CPU's timer to fire once, ms milliseconds from now.
+ * Replaces any event already armed. In one-shot mode a delay beyond the 32-bit
+ * counter is clamped; the scheduler simply re-arms when it fires early.
+ */
+void lapic_timer_arm(uint64_t ms) {
+    cpu_context_t* cpu = get_cpu();
+    if (ms == 0) ms = 1;
+
+    if (cpu->timer_tsc_deadline) {
+        write_msr(MSR_TSC_DEADLINE, rdtsc() + ms * clocksource.tsc_per_ms);
+        return;
+    }
+
+    uint64_t count = ms * cpu->lapic_ticks_per_ms;
+    if (count > 0xFFFFFFFF) count = 0xFFFFFFFF;
+    lapic_write(LAPIC_TICR, (uint32_t)count);
+}
+
+/*
+ * Cancels the pending timer event on the current CPU (tick stopped).
+ */
+void lapic_timer_stop() {
+    if (get_cpu()->timer_tsc_deadline) {
+        write_msr(MSR_TSC_DEADLINE, 0);
+    } else {
+        lapic_write(LAPIC_TICR, 0);
+    }
 }
 
 /*
@@ -2,6 +2,7 @@
 #include <vmm.h>
 #include <pmm.h>
 #include <gdt.h>
+#include <slab.h>
 #include <std_funcs.h>
 
 void cpu_init_context(cpu_context_t* ctx) {
@@ -12,8 +13,12 @@ void cpu_init_context(cpu_context_t* ctx) {
         ctx->rq_count[i] = 0;
         ctx->current_quanta[i] = 0;
     }
+    ctx->rq_bitmap = 0;
+    ctx->rq_nr_queued = 0;
+    ctx->fair_root = NULL;
+    ctx->fair_leftmost = NULL;
     ctx->rq_lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
-    ctx->sleep_lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+    ctx->active_cr3 = read_cr3() & VMM_ADDR_MASK;
     uint64_t addr = (uintptr_t)ctx;
     
     // MSR_GS_BASE (0xC0000101)
@@ -21,6 +26,89 @@ void cpu_init_context(cpu_context_t* ctx) {
 
     // MSR_KERNEL_GS_BASE (0xC0000102)
     write_msr(0xC0000102, addr);
+
+    cpu_detect_topology(ctx);
+}
+
+/* Bits needed to number 'count' logical processors */
+static uint32_t topo_bits(uint32_t count) {
+    uint32_t bits = 0;
+    while ((1u << bits) < count) bits++;
+    return bits;
+}
+
+/*
+ * APIC ID shift of the deepest cache level described by a deterministic
+ * cache leaf (4 on Intel, 0x8000001D on AMD), or -1 if it lists none.
+ */
+static int topo_llc_shift(uint32_t leaf) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t best_level = 0;
+    int shift = -1;
+
+    for (uint32_t sub = 0; sub < 16; sub++) {
+        cpuid(leaf, sub, &eax, &ebx, &ecx, &edx);
+        if (!(eax & 0x1F)) break;           // Cache type 0: no more caches
+
+        uint32_t level = (eax >> 5) & 0x7;
+        if (level >= best_level) {
+            best_level = level;
+            shift = topo_bits(((eax >> 14) & 0xFFF) + 1);
+        }
+    }
+    return shift;
+}
+
+/*
+ * Derives this CPU's place in the topology from its x2APIC ID: the core
+ * (SMT siblings share it) from CPUID leaf 0x1F or 0xB, the last-level
+ * cache from the deterministic cache leaf. Without those leaves every CPU
+ * is its own core and all of them share one LLC. Runs on the CPU itself.
+ */
+void cpu_detect_topology(cpu_context_t* ctx) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_ext_leaf = eax;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t apic_id   = ebx >> 24;
+    uint32_t smt_shift = 0;
+    uint32_t pkg_shift = 8;
+
+    // Extended topology enumeration: V2 (0x1F) when present, else 0xB
+    uint32_t leaf = 0;
+    if (max_leaf >= 0x1F) {
+        cpuid(0x1F, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx) leaf = 0x1F;
+    }
+    if (!leaf && max_leaf >= 0xB) {
+        cpuid(0xB, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx) leaf = 0xB;
+    }
+
+    if (leaf) {
+        for (uint32_t sub = 0; sub < 8; sub++) {
+            cpuid(leaf, sub, &eax, &ebx, &ecx, &edx);
+            uint32_t type = (ecx >> 8) & 0xFF;
+            if (!type) break;
+
+            if (type == 1) smt_shift = eax & 0x1F;  // SMT level
+            pkg_shift = eax & 0x1F;                 // Last level shifts to the package ID
+            apic_id = edx;
+        }
+    }
+
+    int llc_shift = -1;
+    if (max_leaf >= 4) llc_shift = topo_llc_shift(4);
+    if (llc_shift < 0 && max_ext_leaf >= 0x8000001D) llc_shift = topo_llc_shift(0x8000001D);
+    if (llc_shift < 0) llc_shift = pkg_shift;
+
+    ctx->x2apic_id = apic_id;
+    ctx->core_id   = apic_id >> smt_shift;
+    ctx->llc_id    = apic_id >> llc_shift;
 }
 
 void cpu_init_bsp() {
@@ -32,7 +120,6 @@ void cpu_init_bsp() {
     ctx->self = ctx;
     ctx->cpu_id = 0;
     cpu_register_context(ctx);
-    ctx->pmm_last_index = 0;
 
     // 3. Kernel Stack
     void* stack = pmm_alloc_frames(4); // 16KB
@@ -44,6 +131,13 @@ void cpu_init_bsp() {
 
     // 5. MSR GS_BASE
     cpu_init_context(ctx);
+
+    // 6. GS is valid from now on, PMM and slab may use per-CPU caches
+    pmm_cache_enable();
+    slab_magazines_enable();
+
+    // 7. Tag address spaces with PCIDs
+    vmm_enable_pcid();
 }
 
 /*
@@ -55,6 +149,7 @@ void cpu_init_syscalls() {
     extern void syscall_entry();
     write_msr(0xC0000082, (uintptr_t)syscall_entry); 
 
+    // SYSCALL: CS 0x08, SS 0x10. SYSRETQ: SS 0x13 + 8 = 0x1B, CS 0x13 + 16 = 0x23
     uint64_t star = ((uint64_t)0x13 << 48) | ((uint64_t)0x08 << 32);
     write_msr(0xC0000081, star);
 
@@ -14,7 +14,6 @@
  * We use phys_to_virt to write directly to the physical frames.
  */
 static void elf_copy_segment(task_t* t, uintptr_t vaddr, void* src, size_t filesz) {
-    page_table_t* pml4_virt = vmm_get_table(t->cr3);
     size_t copied = 0;
 
     while (copied < filesz) {
@@ -23,11 +22,11 @@ static void elf_copy_segment(task_t* t, uintptr_t vaddr, void* src, size_t files
         size_t to_copy = PAGE_SIZE - offset;
         if (to_copy > (filesz - copied)) to_copy = filesz - copied;
 
-        // Since vma_map already mapped these pages, we just need the phys address
-        uintptr_t dest_phys = vmm_virtual_to_physical(pml4_virt, curr_vaddr);
+        // vma_map only reserved the range, populate the page before writing it
+        uintptr_t dest_phys = vma_get_page(t, curr_vaddr);
         if (!dest_phys) return; 
 
-        void* dest_virt = (void*)(phys_to_virt(dest_phys) + offset);
+        void* dest_virt = (void*)phys_to_virt(dest_phys);
         memcpy(dest_virt, (uint8_t*)src + copied, to_copy);
         
         copied += to_copy;
@@ -54,7 +53,7 @@ uintptr_t elf_load(task_t* t, void* elf_data) {
             if (phdr[i].p_flags & PF_X) vma_flags |= VMA_EXEC;
 
             // 2. Use vma_map to reserve memory and register it in the task's tree
-            // This also handles PMM allocation and VMM mapping internally.
+            // Frames are allocated on demand (page fault or elf_copy_segment).
             int res = vma_map(t, phdr[i].p_vaddr, phdr[i].p_memsz, vma_flags);
             if (res != 0) {
                 kprintf("[ELF] Failed to map segment at %p (Size: %x, Flags: %x)\n", 
@@ -76,11 +75,11 @@ uintptr_t elf_load(task_t* t, void* elf_data) {
     }
 
     // Initialize heap pointers right after the last ELF segment
-    t->heap_start = (max_vaddr + PAGE_SIZE) & ~(PAGE_SIZE - 1);
-    t->heap_curr  = t->heap_start;
-    t->heap_end   = t->heap_start + 4 * PAGE_SIZE;
+    t->mm->heap_start = (max_vaddr + PAGE_SIZE) & ~(PAGE_SIZE - 1);
+    t->mm->heap_curr  = t->mm->heap_start;
+    t->mm->heap_end   = t->mm->heap_start + 4 * PAGE_SIZE;
 
-    vma_map(t, t->heap_start, 4 * PAGE_SIZE,
+    vma_map(t, t->mm->heap_start, 4 * PAGE_SIZE,
             VMA_READ | VMA_WRITE | VMA_USER | VMA_HEAP);
 
     return header->e_entry;
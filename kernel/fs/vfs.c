@@ -1,29 +1,50 @@
 #include <vfs.h>
 #include <kmalloc.h>
+#include <slab.h>
 #include <std_funcs.h>
 #include <panic.h>
 
 /* Global root of the Virtual File System hierarchy */
 static vfs_node_t* vfs_root = NULL;
 
+/* Dedicated cache for VFS nodes */
+static slab_cache_t* vfs_node_cache = NULL;
+
+/*
+ * Cache constructor: a node starts zeroed with an unlocked mutex.
+ */
+static void vfs_node_ctor(void* obj) {
+    vfs_node_t* node = (vfs_node_t*)obj;
+    memset(node, 0, sizeof(vfs_node_t));
+
+    node->lock = (mutex_t){
+        .count   = 1,
+        .waiters = WAIT_QUEUE_INIT,
+        .owner   = NULL
+    };
+}
+
+vfs_node_t* vfs_alloc_node() {
+    return kmem_cache_alloc(vfs_node_cache);
+}
+
+void vfs_free_node(vfs_node_t* node) {
+    kmem_cache_free(vfs_node_cache, node);
+}
+
 /*
  * Initializes the VFS by creating the root directory node.
  * Sets up the initial mutex to manage concurrent access to the root.
  */
 void vfs_init() {
-    vfs_root = (vfs_node_t*)kmalloc(sizeof(vfs_node_t));
-    memset(vfs_root, 0, sizeof(vfs_node_t));
+    vfs_node_cache = kmem_cache_create("vfs_node_t", sizeof(vfs_node_t), _Alignof(vfs_node_t), vfs_node_ctor);
+    if (!vfs_node_cache) kpanic("VFS: Failed to create node cache!");
+
+    // Root mutex is initialized by the cache constructor
+    vfs_root = vfs_alloc_node();
     
     strcpy(vfs_root->name, "/");
     vfs_root->flags = VFS_DIRECTORY;
-    
-    // Initialize root mutex
-    vfs_root->lock = (mutex_t){
-        .count     = 1,
-        .wait_lock = { .ticket = 0, .current = 0, .last_cpu = -1 },
-        .wait_list = NULL,
-        .owner     = NULL
-    };
 }
 
 vfs_node_t* vfs_get_root() {
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <atomic.h>
 
 /* Special keys (not included in ASCII) */
 #define KBD_KEY_UP        0x80
@@ -55,8 +56,12 @@ static const uint8_t scancode_set2_upper[] = {
     0,   '=', '3', '-', '*', '9', 0,   0
 };
 
+/* Readers waiting for input */
+extern wait_queue_t kbd_wait_queue;
+
 void ps2_keyboard_handler();
 void kbd_push_char(char c);
 bool kbd_pop_char(char* out_char);
+bool kbd_has_char();
 
 #endif
@@ -2,6 +2,7 @@
 #define ATOMIC_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 extern int g_lock_enabled;
@@ -14,10 +15,18 @@ typedef struct spinlock {
     int last_cpu;
 } __attribute__((aligned(64))) spinlock_t;
 
+/* FIFO of blocked tasks, embeddable in any object (see wait_queue.h) */
+typedef struct wait_queue {
+    spinlock_t   lock;
+    struct task* head;
+    struct task* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { .lock = { .ticket = 0, .current = 0, .last_cpu = -1 }, .head = NULL, .tail = NULL }
+
 typedef struct mutex {
     int          count;
-    spinlock_t   wait_lock;
-    struct task* wait_list;
+    wait_queue_t waiters;       // waiters.lock also guards count and owner
     struct task* owner;
 } mutex_t;
 
@@ -34,6 +34,14 @@
 #define LAPIC_TDCR          0x03E0   // Timer Divide Configuration Register 
 #define LAPIC_SVR_ENABLE    0x100    // Unit Enable Bit
 
+/* LVT Timer modes (bits 17-18) */
+#define LAPIC_TIMER_ONESHOT      (0 << 17)
+#define LAPIC_TIMER_PERIODIC     (1 << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+
+#define MSR_TSC_DEADLINE    0x6E0
+#define CPUID_ECX_TSC_DEADLINE (1 << 24)
+
 /*
  * ICR
  */
@@ -64,6 +72,8 @@
 #define ICR_SHORTHAND_OTHERS   0xC0000
 
 /* Channels */
+#define IPI_VECTOR_RESCHED     0xFB
+#define IPI_VECTOR_TLB         0xFC
 #define IPI_VECTOR_TEST        0xFD
 #define IPI_VECTOR_HALT        0xFE  
 
@@ -75,6 +85,8 @@ void lapic_init_ap();
 void lapic_write(uint32_t reg, uint32_t data);
 uint32_t lapic_read(uint32_t reg);
 void lapic_timer_init(uint32_t ms_interval, uint8_t vector);
+void lapic_timer_arm(uint64_t ms);
+void lapic_timer_stop();
 
 void lapic_wait_for_delivery();
 void lapic_send_ipi(uint8_t target_lapic_id, uint8_t vector);
@@ -4,10 +4,14 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <pmm.h>
 #include <atomic.h>
 #include <std_funcs.h>
 #include <sched_utils.h>
 
+/* Address spaces cached per CPU under PCIDs 1..N (PCID 0 is left to boot) */
+#define CPU_PCID_SLOTS 8
+
 typedef struct tss {
     uint32_t reserved0;
     uint64_t rsp0;      // Ring 0
@@ -42,7 +46,7 @@ typedef struct gdt_tss_entry {
 } __attribute__((packed)) gdt_tss_entry_t;
 
 typedef struct {
-    gdt_entry_t entries[5];         // Null, KCode, KData, UCode, UData
+    gdt_entry_t entries[5];         // Null, KCode, KData, UData, UCode (order required by sysretq)
     gdt_tss_entry_t tss_entry;
 } __attribute__((packed)) cpu_gdt_t;
 
@@ -52,6 +56,7 @@ typedef struct cpu_context {
     uint64_t lapic_id;              // offset 16
     uint64_t user_rsp;              // offset 24
     uint64_t kernel_stack;          // offset 32
+    uint64_t sysret_off;            // offset 40: syscalls return with iretq only (baseline for benchmarks)
     
     // TSS for each core
     tss_t tss;                      
@@ -63,33 +68,67 @@ typedef struct cpu_context {
         uint64_t base;
     } __attribute__((packed)) gdt_ptr;
     
-    uint64_t pmm_last_index;
+    pmm_cache_t pmm_cache;          // Hot single frames, no global lock
+
+    // PCID slot i holds the address space (CR3) tagged with PCID i + 1
+    uint64_t active_cr3;            // Address space loaded right now (no PCID bits)
+    uint64_t fs_base;               // Last value written to MSR_FS_BASE (user TLS)
+    uint64_t pcid_cr3[CPU_PCID_SLOTS];
+    uint32_t pcid_stale;            // Slots retired by remote shootdowns
+    uint32_t pcid_next;             // Round-robin victim on a miss
+    bool     pcid_enabled;
     uint32_t lapic_ticks_per_ms;
+    bool     timer_tsc_deadline;    // LAPIC timer runs in TSC-deadline mode
+    volatile bool tick_stopped;     // Idle with no timer event armed
+    volatile bool need_resched;     // Run schedule() on the way out of this IRQ
+    volatile bool resched_ipi_pending;  // A reschedule IPI is in flight to us
+
+    // Topology (cpu_detect_topology), compared by the work stealer
+    uint32_t x2apic_id;
+    uint32_t core_id;               // Shared by SMT siblings
+    uint32_t llc_id;                // Shared by CPUs behind the same last-level cache
     
     // Scheduler
     struct task* current_task;
     struct task* idle_task;
+    struct task* switch_prev;       // Task switched away from, until the stubs left its stack
+    struct task* switch_requeue;    // switch_prev, if it must be queued on another CPU
 
     // Runqueue 
     spinlock_t   rq_lock;
+    uint64_t     rq_bitmap;         // Bit p set <=> rq_head[p] != NULL
     struct task* rq_head[PRIORITY_LEVELS];
     struct task* rq_tail[PRIORITY_LEVELS];
     uint32_t rq_count[PRIORITY_LEVELS];
     uint32_t current_quanta[PRIORITY_LEVELS];
+    uint32_t rq_nr_queued;          // Sum of rq_count[], read locklessly by stealers
+
+    // Fair class tree at level PRIO_FAIR (fair.c), under rq_lock
+    struct task* fair_root;
+    struct task* fair_leftmost;     // Cached minimum vruntime
+    uint64_t     fair_min_vruntime; // Monotonic floor that lags are measured against
+    uint32_t     rt_util;           // Admitted real-time bandwidth (rt.c, under its lock)
     uint64_t next_priority_boost;
+    uint64_t next_balance;          // Uptime (ms) of the next push balance
 
-    spinlock_t sleep_lock;
-    struct task* sleeping_list;
+    // Load tracking (sched_update_load)
+    uint32_t load_avg;              // Decaying runnable count, SCHED_LOAD_SCALE = one task
+    uint64_t load_stamp;            // Uptime (ms) the average was last folded at
+
+    struct timer_wheel* timers;     // Sleeps and kernel timers (timer_wheel.c)
 } cpu_context_t;
 
 extern cpu_context_t* cpu_table[32];
 
+#define MSR_FS_BASE     0xC0000100
+
 /* 
  * Initialization of BSP, SYSCALLS and per-CPU context
  */
 void cpu_init_bsp();
 void cpu_init_syscalls();
 void cpu_init_context(cpu_context_t* ctx);
+void cpu_detect_topology(cpu_context_t* ctx);
 
 static inline cpu_context_t* get_cpu() {
     cpu_context_t* ptr;
@@ -114,6 +153,16 @@ static inline void cpu_enable_sse() {
     __asm__ volatile("mov %0, %%cr0" :: "r"(cr0));
 }
 
+/*
+ * CPUID
+ */
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
 /*
  * CR3 READ AND WRITE
  */
@@ -72,6 +72,8 @@ typedef struct {
 /* VFS API */
 void vfs_init();
 vfs_node_t* vfs_get_root();
+vfs_node_t* vfs_alloc_node();
+void vfs_free_node(vfs_node_t* node);
 
 vfs_node_t* vfs_open(const char* path, uint32_t flags);
 void vfs_close(vfs_node_t* node);
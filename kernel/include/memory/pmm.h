@@ -7,13 +7,45 @@
 
 #define PAGE_SIZE 4096
 
-extern uint8_t* bitmap;
-extern uint64_t bitmap_size;
+/* Buddy allocator geometry */
+#define PMM_MAX_ORDER   10          // Largest block: 2^10 frames (4MB)
+#define PMM_NO_FRAME    0xFFFFFFFF  // Free list terminator
+
+/* Per-CPU frame cache geometry */
+#define PMM_CACHE_HIGH  64          // Frames a CPU may hold before draining
+#define PMM_CACHE_BATCH 16          // Frames moved per refill/drain
+
+/* Frame flags */
+#define PMM_FRAME_FREE  (1 << 0)    // Frame heads a free block of 'order'
+
+/* Per-frame metadata, one entry for every 4KB frame of physical memory */
+typedef struct pmm_frame {
+    uint32_t next;      // Free list links (frame indices)
+    uint32_t prev;
+    uint8_t  order;     // Block order (valid only with PMM_FRAME_FREE)
+    uint8_t  flags;
+    uint16_t refs;      // Additional owners of an allocated frame (0 = exclusive)
+} pmm_frame_t;
+
+/* CPU-local stack of free single frames (lives in cpu_context_t) */
+typedef struct pmm_cache {
+    uint32_t count;
+    uint32_t frames[PMM_CACHE_HIGH];    // Frame indices, used LIFO
+} pmm_cache_t;
+
+extern pmm_frame_t* pmm_frames;
+extern uint64_t pmm_frame_count;
 
 void pmm_init(BootInfo* boot_info);
 void* pmm_alloc_frame();
 void* pmm_alloc_frames(size_t count);
 void pmm_free_frame(void* frame);
+void pmm_free_frames(void* frame, size_t count);
+uint64_t pmm_get_free_count();
+void pmm_frame_get(uintptr_t phys);
+void pmm_frame_put(uintptr_t phys);
+uint16_t pmm_frame_refs(uintptr_t phys);
 void pmm_move_to_high_half();
+void pmm_cache_enable();
 
 #endif
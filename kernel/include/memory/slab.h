@@ -21,16 +21,55 @@ typedef struct slab {
     void* data;
 } slab_t;
 
+/* Per-CPU magazine layer */
+#define SLAB_MAX_CPUS   32
+#define SLAB_MAG_SIZE   14          // Objects per magazine
+
+/* Cache flags */
+#define SLAB_NO_MAGAZINES (1 << 0)  // Always go to the slab lists (magazine cache itself)
+
+/* A small stack of free objects, owned by one CPU or parked in the depot */
+typedef struct slab_magazine {
+    uint32_t rounds;                // Objects currently held
+    struct slab_magazine* next;     // Depot list link
+    void* objs[SLAB_MAG_SIZE];
+} slab_magazine_t;
+
+/* CPU-local view of a cache: two magazines and hit counters */
+typedef struct slab_cpu_cache {
+    slab_magazine_t* loaded;        // Serves allocations and frees
+    slab_magazine_t* previous;      // Swapped in when 'loaded' runs empty/full
+    uint64_t alloc_hits;            // Served without taking any lock
+    uint64_t alloc_misses;
+    uint64_t free_hits;
+    uint64_t free_misses;
+} __attribute__((aligned(64))) slab_cpu_cache_t;
+
 typedef struct slab_cache {
     const char* name;
-    size_t obj_size;            
+    size_t obj_size;            // Slot stride (size rounded up to 'align')
+    size_t align;
+    size_t obj_offset;          // First object, past the slab_t header
+    size_t objs_per_slab;
+    void (*ctor)(void*);        // Object initializer for kmem_cache_alloc()
+    uint32_t flags;
+    struct slab_cache* next;    // Registry of kmem_cache_create() caches
     slab_t* partial_slabs;      // Full and empty pages
     slab_t* full_slabs;         // Fully filled
     slab_t* empty_slabs;        // Fully empty
     spinlock_t lock;
+
+    // Magazine depot, exchanged with the per-CPU magazines
+    spinlock_t depot_lock;
+    slab_magazine_t* depot_full;
+    slab_magazine_t* depot_empty;
+
+    slab_cpu_cache_t cpu[SLAB_MAX_CPUS];
 } slab_cache_t;
 
 void slab_init();
+void slab_magazines_enable();
+void slab_dump_stats();
 void* slab_alloc(size_t size);
 void slab_free(void* ptr);
 void slab_grow(slab_cache_t* cache);
@@ -38,6 +77,11 @@ void slab_grow(slab_cache_t* cache);
 void* slab_cache_alloc(slab_cache_t* cache);
 void slab_cache_free(slab_cache_t* cache, void* ptr);
 
+/* Dedicated object caches */
+slab_cache_t* kmem_cache_create(const char* name, size_t size, size_t align, void (*ctor)(void*));
+void* kmem_cache_alloc(slab_cache_t* cache);
+void kmem_cache_free(slab_cache_t* cache, void* obj);
+
 static inline slab_t* get_slab_from_ptr(void* ptr) {
     // Every slab starts at the beginning of page
     return (slab_t*)((uintptr_t)ptr & ~0xFFF);
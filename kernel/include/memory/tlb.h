@@ -0,0 +1,32 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Addresses at or above this are shared by every address space */
+#define TLB_KERNEL_HALF     0xFFFF800000000000ULL
+
+/* Above this many pages a CPU reloads CR3 instead of issuing invlpg */
+#define TLB_FLUSH_MAX_PAGES 32
+
+/* Frames a batch holds back until the TLBs no longer reference them */
+#define TLB_BATCH_FRAMES    32
+
+/* Unmaps of one operation, invalidated in a single shootdown round */
+typedef struct tlb_batch {
+    uintptr_t cr3;                          // Address space of the queued pages
+    uintptr_t start;                        // Range covering every queued page
+    uintptr_t end;
+    uint32_t  count;
+    uintptr_t frames[TLB_BATCH_FRAMES];     // Released after the flush
+} tlb_batch_t;
+
+void tlb_shootdown(uintptr_t cr3, uintptr_t start, uintptr_t end);
+void tlb_shootdown_service();
+
+void tlb_batch_init(tlb_batch_t* batch, uintptr_t cr3);
+void tlb_batch_add(tlb_batch_t* batch, uintptr_t virt, uintptr_t frame);
+void tlb_batch_flush(tlb_batch_t* batch);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <vdso_data.h>
+
+#include <stdint.h>
+
+struct task;
+
+/* Kernel view of the vDSO page (HHDM), NULL before vdso_init() */
+extern vdso_data_t* vdso;
+
+void vdso_init();
+void vdso_update();
+int  vdso_map(struct task* t);
+
+/*
+ * Publishes the task now running on 'cpu_id'. Called by schedule() on
+ * every switch; only that CPU writes its slot.
+ */
+static inline void vdso_switch(uint64_t cpu_id, uint64_t tid) {
+    if (!vdso || cpu_id >= VDSO_MAX_CPUS) return;
+
+    vdso_cpu_t* slot = &vdso->cpu[cpu_id];
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->tid, (uint32_t)tid, __ATOMIC_RELAXED);
+}
+
+#endif
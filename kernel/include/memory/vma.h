@@ -1,8 +1,11 @@
 #ifndef VMA_H
 #define VMA_H
 
+#include <atomic.h>
+
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 struct task;
 
@@ -13,6 +16,13 @@ struct task;
 #define VMA_USER    (1 << 3)
 #define VMA_STACK   (1 << 4) 
 #define VMA_HEAP    (1 << 5)
+#define VMA_SHARED  (1 << 6)    // Same frames in every address space on purpose (no copy-on-write)
+
+/* Page fault error code bits */
+#define PF_ERR_PRESENT  (1 << 0)    // Protection violation (page was present)
+#define PF_ERR_WRITE    (1 << 1)    // Access was a write
+#define PF_ERR_USER     (1 << 2)    // Access came from Ring 3
+#define PF_ERR_INSTR    (1 << 4)    // Access was an instruction fetch
 
 /* Colors */
 typedef enum {
@@ -36,10 +46,41 @@ typedef struct vma_area {
     struct vma_area *prev;
 } vma_area_t;
 
+/*
+ * Address space: page tables, VMAs and heap, shared by every thread of a
+ * process and freed with the last of them.
+ */
+typedef struct mm {
+    uintptr_t cr3;
+
+    vma_area_t* vma_tree_root;
+    vma_area_t* vma_list_head;
+    mutex_t     vma_mutex;
+    uint64_t    vma_count;
+
+    mutex_t   heap_mutex;       // sys_malloc/sys_free of sibling threads
+    uintptr_t heap_start;
+    uintptr_t heap_curr;
+    uintptr_t heap_end;
+
+    mutex_t ring_mutex;         // One SYS_RING_ENTER at a time drains the ring
+    bool    has_ring;           // Syscall ring mapped at SYSRING_BASE
+
+    uint32_t users;             // Tasks running in it
+} mm_t;
+
+mm_t* mm_create(uintptr_t cr3);
+void mm_get(mm_t* mm);
+void mm_put(mm_t* mm);
+
+void vma_init();
 void vma_init_task(struct task* t);
 vma_area_t* vma_find(struct task* t, uintptr_t addr);
 int vma_map(struct task* t, uintptr_t addr, size_t size, uint32_t flags);
 int vma_unmap(struct task* t, uintptr_t addr, size_t size);
+int vma_handle_fault(struct task* t, uintptr_t addr, uint64_t error_code);
+uintptr_t vma_get_page(struct task* t, uintptr_t addr);
+int vma_fork(struct task* parent, struct task* child);
 void vma_destroy_all(struct task* t);
 
 #endif
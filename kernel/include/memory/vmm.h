@@ -9,6 +9,8 @@
 #include <stdbool.h>
 
 #define PAGE_SIZE 4096
+#define PAGE_SIZE_2M 0x200000ULL
+#define PAGE_SIZE_1G 0x40000000ULL
 
 /* Physical address where the kernel is loaded */
 #define KERNEL_PHYS_BASE 0x2000000
@@ -25,8 +27,18 @@
 #define PTE_DIRTY       (1ULL << 6)  // Set by CPU when page is written
 #define PTE_HUGE        (1ULL << 7)  // Large page (PS bit)
 #define PTE_GLOBAL      (1ULL << 8)  // Global page (not flushed from TLB)
+#define PTE_COW         (1ULL << 9)  // Software: read-only share, copy on write
+#define PTE_PAT_HUGE    (1ULL << 12) // PAT bit position in 2MB/1GB entries
 #define PTE_NX          (1ULL << 63) // No-execute bit (requires EFER.NXE)
 
+/* Physical address bits of a 4KB entry */
+#define VMM_ADDR_MASK 0x000000FFFFFFF000ULL
+
+/* CR3 / CR4 bits for Process-Context Identifiers */
+#define CR3_PCID_MASK   0xFFFULL
+#define CR3_NOFLUSH     (1ULL << 63) // Keep the TLB entries of the loaded PCID
+#define CR4_PCIDE       (1ULL << 17)
+
 typedef uint64_t pt_entry;
 
 typedef struct {
@@ -47,6 +59,8 @@ typedef struct {
 
 void vmm_init(BootInfo* bi);
 void vmm_enable_pat();
+void vmm_enable_pcid();
+void vmm_switch_address_space(uintptr_t cr3);
 uintptr_t vmm_create_user_pml4();
 void vmm_destroy_user_pml4(uintptr_t cr3, bool free_frames);
 uintptr_t phys_to_virt(uintptr_t phys);
@@ -56,6 +70,9 @@ void* vmm_map_device(page_table_t* pml4, uintptr_t virt, uintptr_t phys, size_t
 void vmm_map_range(page_table_t* pml4, uintptr_t virt, uintptr_t phys, size_t size, uint64_t flags);
 void vmm_unmap(page_table_t* pml4, uintptr_t virt);
 void vmm_unmap_range(page_table_t* pml4, uintptr_t virt, size_t size);
+uintptr_t vmm_unmap_page(page_table_t* pml4, uintptr_t virt);
+pt_entry vmm_get_entry(page_table_t* pml4, uintptr_t virt);
+bool vmm_clone_range(page_table_t* src, page_table_t* dst, uintptr_t start, uintptr_t end);
 
 page_table_t* vmm_get_pml4();
 uintptr_t vmm_get_pml4_phys();
@@ -77,9 +94,4 @@ static inline page_table_t* vmm_get_table(uintptr_t phys) {
     return (page_table_t*)phys_to_virt(phys);
 }
 
-static inline void sync_tlb() {
-    lapic_broadcast_ipi(IPI_VECTOR_TEST);
-    lapic_wait_for_delivery();
-}
-
 #endif
@@ -0,0 +1,38 @@
+#ifndef CPUMASK_H
+#define CPUMASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Set of CPUs by cpu_id, sized past cpu_table so masks outlive a larger table */
+#define CPUMASK_BITS    256
+#define CPUMASK_WORDS   (CPUMASK_BITS / 64)
+
+typedef struct cpumask {
+    uint64_t bits[CPUMASK_WORDS];
+} cpumask_t;
+
+static inline void cpumask_clear(cpumask_t* mask) {
+    for (int i = 0; i < CPUMASK_WORDS; i++) mask->bits[i] = 0;
+}
+
+static inline void cpumask_fill(cpumask_t* mask) {
+    for (int i = 0; i < CPUMASK_WORDS; i++) mask->bits[i] = ~0ULL;
+}
+
+static inline void cpumask_set(cpumask_t* mask, uint64_t cpu) {
+    if (cpu < CPUMASK_BITS) mask->bits[cpu / 64] |= 1ULL << (cpu % 64);
+}
+
+static inline bool cpumask_test(const cpumask_t* mask, uint64_t cpu) {
+    if (cpu >= CPUMASK_BITS) return false;
+    return (mask->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+/* Mask holding only 'cpu' */
+static inline void cpumask_only(cpumask_t* mask, uint64_t cpu) {
+    cpumask_clear(mask);
+    cpumask_set(mask, cpu);
+}
+
+#endif
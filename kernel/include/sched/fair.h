@@ -0,0 +1,47 @@
+#ifndef FAIR_H
+#define FAIR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Nice range and the weight of nice 0; each nice step is ~1.25x CPU share */
+#define NICE_MIN        -20
+#define NICE_MAX        19
+#define NICE_0_WEIGHT   1024
+
+/* Largest lag behind or ahead of min_vruntime a task keeps off-CPU, in real ns at its weight */
+#define FAIR_LAG_MAX_NS 20000000LL
+
+struct task;
+struct cpu_context;
+
+/* Fair class state, embedded in task_t. Tree links are only valid while queued. */
+typedef struct fair_entity {
+    struct task* left;
+    struct task* right;
+    struct task* parent;
+    bool         red;
+    bool         relative;      // vruntime holds a lag against min_vruntime (off any CPU)
+    int8_t       nice;
+    uint32_t     weight;
+    uint64_t     vruntime;      // CPU time in ns scaled by NICE_0_WEIGHT / weight
+    uint64_t     exec_start;    // ktime_get_ns() when it last started running
+} fair_entity_t;
+
+uint32_t fair_nice_weight(int nice);
+void fair_init_task(struct task* t, int nice);
+void fair_set_nice(struct task* t, int nice);
+
+/* Runqueue tree, callers hold cpu->rq_lock */
+void fair_enqueue(struct cpu_context* cpu, struct task* t);
+void fair_dequeue(struct cpu_context* cpu, struct task* t);
+void fair_detach(struct cpu_context* cpu, struct task* t);
+void fair_make_relative(struct cpu_context* cpu, struct task* t);
+struct task* fair_first(struct cpu_context* cpu);
+struct task* fair_next(struct task* t);
+
+/* Accounting around a fair task's time on the CPU, called by schedule() */
+void fair_start(struct cpu_context* cpu, struct task* t, uint64_t now_ns);
+void fair_stop(struct cpu_context* cpu, struct task* t, uint64_t now_ns);
+
+#endif
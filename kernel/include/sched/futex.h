@@ -0,0 +1,28 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+/* Wait buckets, hashed by the futex key */
+#define FUTEX_HASH_BITS 6
+#define FUTEX_BUCKETS   (1 << FUTEX_HASH_BITS)
+
+struct mm;
+
+/* What a futex word is matched by; all zero while a task waits on none */
+typedef struct futex_key {
+    struct mm* mm;      // Address space of a private word, NULL for a VMA_SHARED mapping
+    uintptr_t  addr;    // User address (private) or physical address (shared)
+} futex_key_t;
+
+/* futex_wait() results */
+#define FUTEX_WOKEN      0
+#define FUTEX_EAGAIN    -1      // The word no longer held the expected value
+#define FUTEX_ETIMEDOUT -2
+#define FUTEX_EFAULT    -3      // Misaligned or not a mapped user address
+
+void futex_init();
+int  futex_wait(uintptr_t uaddr, uint32_t val, uint64_t timeout_ms);
+int  futex_wake(uintptr_t uaddr, uint32_t count);
+
+#endif
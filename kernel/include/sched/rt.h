@@ -0,0 +1,45 @@
+#ifndef RT_H
+#define RT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <timer_wheel.h>
+
+/* CPU bandwidth as a fraction of 1 << RT_UTIL_SHIFT; admission stops at 95% per CPU */
+#define RT_UTIL_SHIFT       20
+#define RT_UTIL_MAX         ((95u << RT_UTIL_SHIFT) / 100)
+#define RT_PERIOD_MAX_MS    10000
+
+struct task;
+struct cpu_context;
+
+/* Real-time (EDF) state, embedded in task_t */
+typedef struct rt_entity {
+    uint64_t runtime_ns;        // Budget granted every period
+    uint64_t period_ns;         // Also the relative deadline
+    int64_t  budget_ns;         // Left in the current period
+    uint64_t deadline_ns;       // Absolute (ktime_get_ns), EDF key
+    uint64_t exec_start;        // ktime_get_ns() when it last started running
+    uint32_t util;              // runtime / period, reserved on 'cpu' while admitted
+    int32_t  cpu;               // CPU it was admitted on, -1 if none
+    ktimer_t timer;             // Replenishment while throttled
+    bool     throttled;         // 'timer' is armed, under task->state_lock
+} rt_entity_t;
+
+void rt_init_task(struct task* t);
+int  rt_admit(struct task* t, uint64_t runtime_ms, uint64_t period_ms);
+void rt_release(struct task* t);
+
+/* Runqueue list at PRIO_RT, callers hold cpu->rq_lock */
+void rt_enqueue(struct cpu_context* cpu, struct task* t);
+
+/* Budget handling, called by enqueue_task() and schedule() */
+bool rt_runnable(struct task* t, uint64_t now_ns);
+void rt_start(struct task* t, uint64_t now_ns);
+void rt_stop(struct task* t, uint64_t now_ns);
+
+static inline bool rt_deadline_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+#endif
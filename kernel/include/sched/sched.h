@@ -6,10 +6,29 @@
 #include <atomic.h>
 #include <vma.h>
 #include <sched_utils.h>
+#include <timer_wheel.h>
+#include <wait_queue.h>
+#include <cpumask.h>
+#include <fair.h>
+#include <rt.h>
+#include <futex.h>
 
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Time slice while a CPU has work; an idle CPU runs without a tick */
+#define SCHED_TICK_MS 5
+
+/* Load average: fixed point with one runnable task = SCHED_LOAD_SCALE, 1/8 new sample per tick */
+#define SCHED_LOAD_SCALE 1024
+#define SCHED_LOAD_SHIFT 3
+
+/* Most tasks a single steal moves off a victim's runqueue */
+#define SCHED_STEAL_MAX  8
+
+/* Period of the push balancer on a busy CPU */
+#define SCHED_BALANCE_MS 20
+
 typedef struct task {
     uint64_t  tid;
     uintptr_t rsp;          
@@ -17,30 +36,51 @@ typedef struct task {
     uint64_t  stack_size;
 
     task_state_t  state;
-    task_reason_t wait_reason;
+    spinlock_t    state_lock;   // Orders a wakeup against schedule()'s block decision
+    bool          on_rq;        // Running or queued; cleared when schedule() takes it off the CPU
+    volatile bool on_cpu;       // A CPU still uses its kernel stack (until the switch away is done)
+
+    // Wait queue membership (wait_queue.c)
+    wait_queue_t* wait_queue;   // Queue we are blocked on, NULL if none
+    struct task*  wait_next;
+    struct task*  wait_prev;
+    bool          wait_timed_out;
+    futex_key_t   futex_key;    // Word waited on in futex_wait()
+
     bool is_user;       
-    uintptr_t cr3;
-
-    // VMA & Memory Management
-    struct vma_area* vma_tree_root; 
-    struct vma_area* vma_list_head;
-    mutex_t    vma_mutex;
-    uint64_t   vma_count; 
-    
-    uintptr_t heap_start;
-    uintptr_t heap_curr;
-    uintptr_t heap_end;          
+    uintptr_t cr3;          // Same as mm->cr3 for user tasks, kept here for schedule()
+
+    // Memory Management: threads of one process share 'mm'
+    struct mm* mm;          // NULL for kernel tasks
+    uintptr_t  ustack_base; // Thread stack VMA (THREAD_STACK_SIZE), 0 for a process' first task
+    uintptr_t  fs_base;     // TLS base loaded into FS_BASE while it runs
 
     struct task* next;        // Global list for Reaper
     struct task* prev;  
     struct task* sched_next;  // Runqueue Per-CPU
     task_prio_t  priority;
     task_prio_t  base_priority;
+    sched_policy_t policy;
+    sched_policy_t policy_next; // Applied by the next enqueue_task()
+    fair_entity_t  fair;
+    rt_entity_t    rt;
 
-    uint64_t cpu_id;
-    uint64_t sleep_until;
+    uint64_t  cpu_id;         // CPU it last ran or was queued on
+    cpumask_t affinity;       // CPUs it may run on
+    ktimer_t  sleep_timer;     // Armed by sched_make_task_sleep
 } __attribute__((aligned(64))) task_t;
 
+/*
+ * User stacks of threads: one-page guard gap between slots, handed out
+ * top-down below the syscall ring, first free slot wins
+ */
+#define THREAD_STACK_TOP    0x00007FFFF0000000ULL
+#define THREAD_STACK_SIZE   0x10000ULL
+#define THREAD_STACK_SLOTS  1024
+
+/* Dedicated slab cache for task_t (created by sched_init) */
+extern struct slab_cache* task_cache;
+
 void sched_init();
 void sched_init_ap();
 uint64_t schedule(interrupt_frame_t* frame);
@@ -50,14 +90,30 @@ void sched_reap();
 
 void enqueue_task(cpu_context_t* cpu, task_t* task);
 task_t* dequeue_task(cpu_context_t* cpu);
-void sched_update_sleepers();
 void sched_make_task_sleep(uint64_t ms);
-void sched_block_current(task_reason_t reason);
-void sched_wakeup(task_reason_t reason);
+void sched_wake_task(task_t* t);
+void sched_kick_cpu(cpu_context_t* cpu);
+void sched_switch_done();
+cpu_context_t* sched_select_cpu(task_t* t, cpu_context_t* prev);
+
+int sched_set_affinity(uint64_t tid, const cpumask_t* mask);
+int sched_set_policy(uint64_t tid, sched_policy_t policy, int nice);
+int sched_set_deadline(uint64_t tid, uint64_t runtime_ms, uint64_t period_ms);
+
+/*
+ * Main (TID 0) and idle (TID 1) tasks are pinned to their CPU by their mask.
+ * An admitted real-time task only runs on the CPU holding its bandwidth.
+ */
+static inline bool sched_task_allowed(task_t* t, cpu_context_t* cpu) {
+    if (t->policy == SCHED_POLICY_RT && t->rt.cpu >= 0) return cpu->cpu_id == (uint64_t)t->rt.cpu;
+    return cpumask_test(&t->affinity, cpu->cpu_id);
+}
 
 task_t* sched_get_current();
 task_t* arch_task_create(void (*entry_point)(void));
 task_t* arch_task_create_user(void (*entry_point)(void));
 task_t* arch_task_spawn_elf(void* elf_raw_data);
+task_t* arch_task_fork(interrupt_frame_t* parent_frame);
+task_t* arch_task_thread(uintptr_t entry, uint64_t arg0, uint64_t arg1, uintptr_t tls);
 
 #endif
@@ -1,16 +1,34 @@
 #ifndef SCHED_UTILS_H
 #define SCHED_UTILS_H
 
+/*
+ * 64 runqueue levels, one bit each in cpu_context_t.rq_bitmap (0 = most urgent).
+ * The named priorities are spread one band apart; levels below PRIO_HIGH
+ * are reserved for more urgent classes. PRIO_RT (a deadline-ordered list)
+ * and PRIO_FAIR (a vruntime tree) each hold a whole class; no boost can
+ * land on either.
+ */
 typedef enum {
-    PRIO_HIGH   = 0,
-    PRIO_NORMAL = 1,
-    PRIO_LOW    = 2,
-    PRIO_IDLE   = 3,
+    PRIO_RT     = 0,
+    PRIO_HIGH   = 16,
+    PRIO_NORMAL = 32,
+    PRIO_FAIR   = 47,
+    PRIO_LOW    = 48,
+    PRIO_IDLE   = 63,
 
-    PRIORITY_LEVELS = 4,
+    PRIORITY_LEVELS = 64,
+    PRIORITY_BAND   = 16,   // Distance a boost lifts a waiting level
     PRIORITY_BOOST  = 100
 } task_prio_t;
 
+/* Scheduling classes a task can belong to */
+typedef enum {
+    SCHED_POLICY_MLFQ,      // Fixed runqueue levels with quanta and boosts (default)
+    SCHED_POLICY_FAIR,      // Weighted virtual runtime at PRIO_FAIR (fair.c)
+    SCHED_POLICY_RT,        // EDF with runtime/period budgets at PRIO_RT (rt.c)
+    SCHED_POLICY_COUNT
+} sched_policy_t;
+
 typedef enum {
     TASK_READY,
     TASK_RUNNING,
@@ -20,9 +38,4 @@ typedef enum {
     TASK_BLOCKED
 } task_state_t;
 
-typedef enum {
-    REASON_KEYBOARD,
-    REASON_MUTEX
-} task_reason_t;
-
 #endif
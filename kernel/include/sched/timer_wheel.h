@@ -0,0 +1,58 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <atomic.h>
+
+/* Wheel geometry: 4 levels x 64 slots, 1ms per slot at level 0, each level 64x coarser */
+#define TW_LEVELS       4
+#define TW_SLOT_BITS    6
+#define TW_SLOTS        (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK    (TW_SLOTS - 1)
+#define TW_MAX_DELTA    ((1ULL << (TW_LEVELS * TW_SLOT_BITS)) - 1)  // ~4.6h, longer timers are requeued
+#define TW_NEVER        ((uint64_t)-1)
+
+struct cpu_context;
+struct timer_wheel;
+struct ktimer;
+
+typedef void (*ktimer_fn_t)(struct ktimer* timer);
+
+/* Kernel timer, embedded in its owner. Callbacks run in IRQ context on the wheel's CPU. */
+typedef struct ktimer {
+    struct ktimer*  next;
+    struct ktimer** pprev;          // Link that points at us, NULL when not queued
+    uint64_t        expires;        // Uptime (ms)
+    ktimer_fn_t     fn;
+    void*           data;
+    struct timer_wheel* wheel;      // Wheel it was last queued on
+    uint8_t         level;
+    uint8_t         slot;
+    volatile bool   running;        // Detached for expiry, callback not yet returned
+} ktimer_t;
+
+/* Per-CPU hierarchical timing wheel (one 4KB frame) */
+typedef struct timer_wheel {
+    spinlock_t lock;
+    uint64_t   clk;                         // Next millisecond to process
+    uint64_t   pending[TW_LEVELS];          // Bit s set <=> slots[level][s] != NULL
+    ktimer_t*  slots[TW_LEVELS][TW_SLOTS];
+} timer_wheel_t;
+
+void timer_wheel_init_cpu(struct cpu_context* cpu);
+void timer_wheel_run();
+uint64_t timer_wheel_next_event(struct cpu_context* cpu);
+
+void ktimer_init(ktimer_t* timer, ktimer_fn_t fn, void* data);
+void ktimer_add(ktimer_t* timer, uint64_t expires);
+void ktimer_add_on(struct cpu_context* cpu, ktimer_t* timer, uint64_t expires);
+bool ktimer_cancel(ktimer_t* timer);
+bool ktimer_cancel_sync(ktimer_t* timer);
+
+static inline bool ktimer_pending(ktimer_t* timer) {
+    return timer->pprev != NULL;
+}
+
+#endif
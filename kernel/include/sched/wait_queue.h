@@ -0,0 +1,42 @@
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include <atomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* wait_queue_t and WAIT_QUEUE_INIT live in atomic.h so that mutex_t can embed them */
+
+void wait_queue_init(wait_queue_t* wq);
+
+void wait_prepare(wait_queue_t* wq);
+void wait_cancel(wait_queue_t* wq);
+void wait_sleep(wait_queue_t* wq);
+bool wait_sleep_timeout(wait_queue_t* wq, uint64_t ms);
+
+void wake_up_one(wait_queue_t* wq);
+void wake_up_all(wait_queue_t* wq);
+
+/* Building blocks for primitives that guard their own state with wq->lock */
+void wait_queue_add_locked(wait_queue_t* wq, struct task* t);
+struct task* wait_queue_pop_locked(wait_queue_t* wq);
+void wait_queue_remove_locked(wait_queue_t* wq, struct task* t);
+void wait_queue_wake_task(struct task* t);
+
+/*
+ * Sleeps on 'wq' until 'cond' holds. The condition is re-checked after the
+ * task is queued, so a wakeup between the check and the sleep is not lost.
+ */
+#define wait_event(wq, cond)                    \
+    do {                                        \
+        while (!(cond)) {                       \
+            wait_prepare(wq);                   \
+            if (cond) {                         \
+                wait_cancel(wq);                \
+                break;                          \
+            }                                   \
+            wait_sleep(wq);                     \
+        }                                       \
+    } while (0)
+
+#endif
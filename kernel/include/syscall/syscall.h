@@ -4,8 +4,10 @@
 #include <idt.h>
 #include <stdint.h>
 
+#define SYS_TABLE_SIZE  32
+
 typedef uint64_t (*syscall_ptr_t)(interrupt_frame_t*);
-extern syscall_ptr_t sys_table[20];
+extern syscall_ptr_t sys_table[SYS_TABLE_SIZE];
 
 #define SYS_KPRINT      1
 #define SYS_EXIT        2
@@ -19,10 +21,25 @@ extern syscall_ptr_t sys_table[20];
 #define SYS_FREE        10
 #define SYS_GET_TID     11
 #define SYS_CPU_COUNT   12
+#define SYS_FORK        13
+#define SYS_SCHED_SETAFFINITY 14
+#define SYS_SCHED_SETPOLICY   15
+#define SYS_SCHED_SETDEADLINE 16
+#define SYS_RING_SETUP        17
+#define SYS_RING_ENTER        18
+#define SYS_FUTEX_WAIT        19
+#define SYS_FUTEX_WAKE        20
+#define SYS_THREAD_CREATE     21
+#define SYS_SET_TLS           22
+#define SYS_SET_SYSRET        23
 
 /* 
  * Global initialization of jump table 
  */
 void init_sys_table();
 
+/* Syscall ring (sysring.c) */
+uint64_t sys_ring_setup_handler(interrupt_frame_t* frame);
+uint64_t sys_ring_enter_handler(interrupt_frame_t* frame);
+
 #endif
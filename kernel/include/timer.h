@@ -2,14 +2,75 @@
 #define TIMER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
-/* Gloabl uptime */
-extern volatile uint64_t system_uptime_ms;
+/* ns = ((tsc - tsc_base) * mult) >> CLOCK_SHIFT */
+#define CLOCK_SHIFT     32
+#define CLOCK_MAX_CPUS  32
+#define TSC_SYNC_ROUNDS 16          // Round trips per AP, the fastest one wins
+
+#define MSR_TSC_AUX     0xC0000103  // Returned in ECX by RDTSCP
+
+/*
+ * TSC clocksource. Written once by the BSP (plus each AP's own offset during
+ * bring-up) and only read afterwards, so readers take no lock. Holds no
+ * kernel pointers, so the same layout can be handed to user space.
+ */
+typedef struct clocksource {
+    uint64_t tsc_base;              // BSP TSC at calibration (ktime 0)
+    uint64_t tsc_per_ms;            // Measured against the PIT (0 until calibrated)
+    uint64_t mult;                  // Fixed-point ns per TSC tick
+    bool     invariant;             // Constant rate across P-/C-states
+    bool     rdtscp;                // TSC_AUX holds the CPU id
+    int64_t  offset[CLOCK_MAX_CPUS];// Added to a CPU's TSC to get BSP time
+} clocksource_t;
+
+extern clocksource_t clocksource;
 
 void msleep(uint64_t ms);
+void clocksource_init(uint64_t tsc_start, uint64_t tsc_end, uint32_t window_ms);
+void clocksource_init_cpu(uint64_t cpu_id);
+void tsc_sync_source();
+void tsc_sync_target(uint64_t cpu_id);
+
+static inline uint64_t rdtsc() {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/*
+ * TSC of the calling CPU translated onto the BSP's timeline. RDTSCP returns
+ * the counter and the CPU id in one instruction, so a migration in between
+ * cannot pair one CPU's counter with another CPU's offset.
+ */
+static inline uint64_t clock_read_tsc() {
+    if (!clocksource.rdtscp) return rdtsc();
+
+    uint32_t low, high, aux;
+    __asm__ volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+    return (((uint64_t)high << 32) | low) + clocksource.offset[aux % CLOCK_MAX_CPUS];
+}
+
+/*
+ * Nanoseconds since timer calibration. Lock-free and monotonic on each CPU;
+ * across CPUs it agrees to within the sync error of the offsets.
+ */
+static inline uint64_t ktime_get_ns() {
+    uint64_t mult = clocksource.mult;
+    if (!mult) return 0;
+
+    int64_t delta = (int64_t)(clock_read_tsc() - clocksource.tsc_base);
+    if (delta < 0) return 0;
+    return (uint64_t)(((unsigned __int128)delta * mult) >> CLOCK_SHIFT);
+}
 
+/*
+ * Milliseconds since timer calibration. Read straight from the TSC, so it
+ * keeps counting while every CPU sits tickless in HLT.
+ */
 static inline uint64_t get_uptime_ms() {
-    return system_uptime_ms;
+    return ktime_get_ns() / 1000000;
 }
 
 #endif
@@ -2,231 +2,411 @@
 #include <vmm.h>
 #include <cpu.h>
 #include <atomic.h>
+#include <std_funcs.h>
 #include <efi_descriptor.h>
 
 #define HHDM_OFFSET 0xFFFF800000000000
+#define PMM_LOW_MEMORY_END 0x100000
 
-uint8_t* bitmap = NULL;
-uint64_t bitmap_size = 0;
+pmm_frame_t* pmm_frames = NULL;
+uint64_t pmm_frame_count = 0;
 
 static spinlock_t pmm_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };
 
+/* Buddy free lists, one per order, linked through pmm_frames[] */
+static uint32_t free_head[PMM_MAX_ORDER + 1];
+static uint32_t free_mask = 0;      // Bit N set -> free_head[N] is not empty
+static uint64_t free_frames = 0;
+
+/* Set once GS_BASE points at a valid cpu_context_t on the BSP */
+static volatile bool cache_online = false;
+
 /*
- * Updates the physical memory bitmap by marking a specific 4KB frame as used (1).
- * This is a low-level helper used during allocation and manual frame reservations.
+ * FREE LIST HELPERS
  */
-static void pmm_set_frame(uint64_t frame_addr) {
-    uint64_t frame_index = frame_addr / PAGE_SIZE;
-    bitmap[frame_index / 8] |= (1 << (frame_index % 8));
+static void buddy_list_push(uint64_t idx, uint8_t order) {
+    pmm_frame_t* f = &pmm_frames[idx];
+    f->order = order;
+    f->flags |= PMM_FRAME_FREE;
+    f->prev = PMM_NO_FRAME;
+    f->next = free_head[order];
+
+    if (free_head[order] != PMM_NO_FRAME) pmm_frames[free_head[order]].prev = idx;
+    free_head[order] = idx;
+    free_mask |= (1U << order);
+}
+
+static void buddy_list_remove(uint64_t idx) {
+    pmm_frame_t* f = &pmm_frames[idx];
+    uint8_t order = f->order;
+
+    if (f->prev != PMM_NO_FRAME) pmm_frames[f->prev].next = f->next;
+    else free_head[order] = f->next;
+    if (f->next != PMM_NO_FRAME) pmm_frames[f->next].prev = f->prev;
+
+    f->flags &= ~PMM_FRAME_FREE;
+    if (free_head[order] == PMM_NO_FRAME) free_mask &= ~(1U << order);
 }
 
 /*
- * Marks a specific 4KB frame as free (0) in the physical memory bitmap.
+ * Takes a block of exactly 2^order frames. The smallest non-empty order
+ * is found with a single ctz on free_mask, and larger blocks are split
+ * in halves, returning the upper halves to their free lists.
  */
-static void pmm_unset_frame(uint64_t frame_addr) {
-    uint64_t frame_index = frame_addr / PAGE_SIZE;
-    bitmap[frame_index / 8] &= ~(1 << (frame_index % 8));
+static uint64_t buddy_alloc(uint8_t order) {
+    uint32_t avail = free_mask >> order;
+    if (!avail) return PMM_NO_FRAME;
+
+    uint8_t o = order + __builtin_ctz(avail);
+    uint64_t idx = free_head[o];
+    buddy_list_remove(idx);
+
+    while (o > order) {
+        o--;
+        buddy_list_push(idx + (1ULL << o), o);
+    }
+
+    free_frames -= (1ULL << order);
+    return idx;
 }
 
 /*
- * Checks specific frame.
+ * Returns a 2^order block and merges it with its buddy for as long as
+ * the buddy is a free block of the same order.
  */
-static int pmm_is_frame_set(uint64_t frame_addr) {
-    uint64_t frame_index = frame_addr / PAGE_SIZE;
-    return (bitmap[frame_index / 8] & (1 << (frame_index % 8))) != 0;
+static void buddy_free(uint64_t idx, uint8_t order) {
+    free_frames += (1ULL << order);
+
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = idx ^ (1ULL << order);
+        if (buddy >= pmm_frame_count) break;
+
+        pmm_frame_t* b = &pmm_frames[buddy];
+        if (!(b->flags & PMM_FRAME_FREE) || b->order != order) break;
+
+        buddy_list_remove(buddy);
+        idx &= ~(1ULL << order);
+        order++;
+    }
+
+    buddy_list_push(idx, order);
+}
+
+/*
+ * Releases an arbitrary run of frames by splitting it into the largest
+ * naturally aligned power-of-two blocks.
+ */
+static void buddy_free_range(uint64_t idx, uint64_t count) {
+    while (count) {
+        uint8_t order = PMM_MAX_ORDER;
+        if (idx) {
+            uint8_t align = __builtin_ctzll(idx);
+            if (align < order) order = align;
+        }
+        while ((1ULL << order) > count) order--;
+
+        buddy_free(idx, order);
+        idx   += (1ULL << order);
+        count -= (1ULL << order);
+    }
+}
+
+/*
+ * Serves runs larger than one max-order block. Free memory is always
+ * merged up to PMM_MAX_ORDER, so a free aligned 4MB region is a single
+ * block: scan for 'blocks' of them in a row. Slow, only hit by rare huge
+ * allocations. Caller holds pmm_lock_.
+ */
+static uint64_t buddy_alloc_large(uint64_t blocks) {
+    const uint64_t step = 1ULL << PMM_MAX_ORDER;
+    uint64_t start = 0, found = 0;
+
+    for (uint64_t idx = 0; idx + step <= pmm_frame_count; idx += step) {
+        pmm_frame_t* f = &pmm_frames[idx];
+        if (!(f->flags & PMM_FRAME_FREE) || f->order != PMM_MAX_ORDER) {
+            found = 0;
+            continue;
+        }
+
+        if (found++ == 0) start = idx;
+        if (found < blocks) continue;
+
+        for (uint64_t i = 0; i < blocks; i++) buddy_list_remove(start + i * step);
+        free_frames -= blocks * step;
+        return start;
+    }
+
+    return PMM_NO_FRAME;
+}
+
+static uint8_t pmm_order_for(size_t count) {
+    if (count <= 1) return 0;
+    return 64 - __builtin_clzll(count - 1);
 }
 
 /*
  * Initializes the Physical Memory Manager using the EFI Memory Map.
  * Performs three passes:
- * 1. Determines the highest physical address to size the bitmap.
- * 2. Finds a large enough contiguous free region to store the bitmap.
- * 3. Marks usable RAM (Conventional Memory) as free, while protecting 
- *    the first 1MB, the kernel, and the bitmap itself.
+ * 1. Determines the highest physical address to size the frame array.
+ * 2. Finds a large enough contiguous free region to store the frame array.
+ * 3. Releases usable RAM (Conventional Memory) into the buddy free lists,
+ *    while protecting the first 1MB, the kernel, and the frame array itself.
  */
 void pmm_init(BootInfo* boot_info) {
     uint64_t highest_addr = 0;
     BootMemoryMap* mmap = &boot_info->mmap;
     uint64_t entries = mmap->memory_map_size / mmap->descriptor_size;
 
-    // First pass: Find the highest physical address to determine bitmap size
+    // First pass: Find the highest physical address to determine the array size
     for (uint64_t i = 0; i < entries; i++) {
         EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)((uint8_t*)mmap->memory_map + (i * mmap->descriptor_size));
         uint64_t end_addr = desc->physical_start + (desc->num_pages * PAGE_SIZE);
         if (end_addr > highest_addr) highest_addr = end_addr;
     }
 
-    // bitmap_size = (number of pages) / 8 bits per byte
-    bitmap_size = (highest_addr / PAGE_SIZE) / 8;
+    pmm_frame_count = highest_addr / PAGE_SIZE;
+    uint64_t meta_size = PAGE_ALIGN_UP(pmm_frame_count * sizeof(pmm_frame_t));
 
-    // Second pass: Find a free spot for the bitmap itself
+    // Second pass: Find a free spot for the frame array itself
     for (uint64_t i = 0; i < entries; i++) {
         EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)((uint8_t*)mmap->memory_map + (i * mmap->descriptor_size));
-        if (desc->type == EFI_CONVENTIONAL_MEMORY && (desc->num_pages * PAGE_SIZE) >= bitmap_size) {
-            bitmap = (uint8_t*)PAGE_ALIGN_UP(desc->physical_start);
-            // Initialize bitmap: set all frames as "used" (1) by default
-            for(uint64_t j = 0; j < bitmap_size; j++) bitmap[j] = 0xFF;
+        if (desc->type == EFI_CONVENTIONAL_MEMORY && desc->physical_start >= PMM_LOW_MEMORY_END &&
+            (desc->num_pages * PAGE_SIZE) >= meta_size) {
+            pmm_frames = (pmm_frame_t*)PAGE_ALIGN_UP(desc->physical_start);
+            // Every frame starts out as "not free"
+            memset(pmm_frames, 0, meta_size);
             break;
         }
     }
 
-    // Third pass: Unlock only Conventional Memory frames in the bitmap
+    for (int o = 0; o <= PMM_MAX_ORDER; o++) free_head[o] = PMM_NO_FRAME;
+
+    uint64_t kernel_start = (uint64_t)boot_info->kernel.kernel_base;
+    uint64_t kernel_end   = kernel_start + boot_info->kernel.kernel_size + PAGE_SIZE;
+    uint64_t meta_start   = (uint64_t)pmm_frames;
+    uint64_t meta_end     = meta_start + meta_size;
+
+    // Third pass: Release Conventional Memory frames as maximal buddy blocks
     for (uint64_t i = 0; i < entries; i++) {
         EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)((uint8_t*)mmap->memory_map + (i * mmap->descriptor_size));
-        if (desc->type == EFI_CONVENTIONAL_MEMORY || desc->type == 4) {
-            for (uint64_t j = 0; j < desc->num_pages; j++) {
-                uint64_t addr = desc->physical_start + (j * PAGE_SIZE);
-                if (addr >= 0x100000) pmm_unset_frame(addr);
+        if (desc->type != EFI_CONVENTIONAL_MEMORY && desc->type != EFI_BOOT_SERVICES_DATA) continue;
+
+        uint64_t run_start = 0, run_len = 0;
+        for (uint64_t j = 0; j < desc->num_pages; j++) {
+            uint64_t addr = desc->physical_start + (j * PAGE_SIZE);
+
+            // Lock first 1MB (BIOS/UEFI), KERNEL and the frame array
+            bool reserved = addr < PMM_LOW_MEMORY_END ||
+                            (addr >= kernel_start && addr < kernel_end) ||
+                            (addr >= meta_start && addr < meta_end);
+
+            if (!reserved) {
+                if (!run_len) run_start = addr / PAGE_SIZE;
+                run_len++;
+                continue;
             }
+            if (run_len) buddy_free_range(run_start, run_len);
+            run_len = 0;
         }
+        if (run_len) buddy_free_range(run_start, run_len);
     }
-    
-    // Lock first 1MB (BIOS/UEFI)
-    for (uint64_t i = 0; i < 0x100000; i += PAGE_SIZE) pmm_set_frame(i);
+}
 
-    // Lock KERNEL
-    uint64_t kernel_start = (uint64_t)boot_info->kernel.kernel_base;
-    uint64_t kernel_size = boot_info->kernel.kernel_size;
-    for (uint64_t addr = kernel_start; addr < kernel_start + kernel_size + PAGE_SIZE; addr += PAGE_SIZE) {
-        pmm_set_frame(addr);
+/*
+ * PER-CPU FRAME CACHE
+ * Must be called with interrupts disabled, the cache belongs to the running CPU.
+ */
+static pmm_cache_t* pmm_local_cache() {
+    if (!cache_online) return NULL;
+    return &get_cpu()->pmm_cache;
+}
+
+/* Moves up to PMM_CACHE_BATCH order-0 frames from the buddy lists into 'pc' */
+static void pmm_cache_refill(pmm_cache_t* pc) {
+    spin_lock(&pmm_lock_);
+    while (pc->count < PMM_CACHE_BATCH) {
+        uint64_t idx = buddy_alloc(0);
+        if (idx == PMM_NO_FRAME) break;
+        pc->frames[pc->count++] = idx;
+    }
+    spin_unlock(&pmm_lock_);
+}
+
+/* Returns the PMM_CACHE_BATCH coldest frames of 'pc' to the buddy lists */
+static void pmm_cache_drain(pmm_cache_t* pc) {
+    spin_lock(&pmm_lock_);
+    for (uint32_t i = 0; i < PMM_CACHE_BATCH; i++) {
+        buddy_free(pc->frames[i], 0);
     }
+    spin_unlock(&pmm_lock_);
 
-    // Lock BITMAP
-    uint64_t bitmap_addr = (uint64_t)bitmap;
-    for (uint64_t i = 0; i < (bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE; i++) {
-        pmm_set_frame(bitmap_addr + (i * PAGE_SIZE));
+    pc->count -= PMM_CACHE_BATCH;
+    for (uint32_t i = 0; i < pc->count; i++) {
+        pc->frames[i] = pc->frames[i + PMM_CACHE_BATCH];
     }
 }
 
+/*
+ * Enables the per-CPU caches. Called by the BSP once its GS_BASE is loaded,
+ * APs always set up their context before touching the PMM.
+ */
+void pmm_cache_enable() {
+    cache_online = true;
+}
+
 /*
  * Allocates a single 4KB physical frame.
- * Uses a per-CPU hint (pmm_last_index) to speed up the search and reduce
- * lock contention in SMP environments. Returns a 4KB-aligned physical address.
+ * The common path pops a frame from the CPU-local cache without touching
+ * the global lock, only an empty cache is refilled in one batch from the
+ * order-0 buddy list. Returns a 4KB-aligned physical address.
  */
 void* pmm_alloc_frame() {
-    if (bitmap == NULL) return NULL;
-    
+    if (pmm_frames == NULL) return NULL;
+
+    uint64_t idx = PMM_NO_FRAME;
     uint64_t f = spin_irq_save();
-    spin_lock(&pmm_lock_);
 
-    // Get current CPU context
-    cpu_context_t* cpu = get_cpu();
-    // If not, use default value
-    uint64_t start_index = cpu ? cpu->pmm_last_index : 0;
-
-    for (uint64_t i = start_index; i < bitmap_size; i++) {
-        if (bitmap[i] == 0xFF) continue;
-
-        // __builtin_ctz (Count Trailing Zeros), finding first '0'
-        uint8_t free_bits = ~bitmap[i];
-        if (free_bits) {
-            int b = __builtin_ctz(free_bits);
-            if (b < 8) {
-                uint64_t frame_index = i * 8 + b;
-                uint64_t frame_addr = frame_index * PAGE_SIZE;
-                if (frame_addr == 0) continue;
-
-                bitmap[i] |= (1 << b);
-                if (cpu) cpu->pmm_last_index = i;
-
-                spin_unlock(&pmm_lock_);
-                spin_irq_restore(f);
-                return (void*)frame_addr;
-            }
-        }
+    pmm_cache_t* pc = pmm_local_cache();
+    if (pc) {
+        if (pc->count == 0) pmm_cache_refill(pc);
+        if (pc->count) idx = pc->frames[--pc->count];
+    } else {
+        spin_lock(&pmm_lock_);
+        idx = buddy_alloc(0);
+        spin_unlock(&pmm_lock_);
     }
 
-    spin_unlock(&pmm_lock_);
     spin_irq_restore(f);
 
-    return NULL; 
+    if (idx == PMM_NO_FRAME) return NULL;
+    return (void*)(idx * PAGE_SIZE);
 }
 
 /*
  * Allocates multiple contiguous physical frames.
  * Used primarily for large data structures like kernel stacks or initial paging tables.
- * Search is performed globally from the start of the bitmap.
+ * The request is rounded up to a power-of-two block and the unused tail
+ * is given back immediately, so no frames are wasted. Runs above
+ * 2^PMM_MAX_ORDER frames are put together from adjacent max-order blocks.
  */
 void* pmm_alloc_frames(size_t count) {
-    if (bitmap == NULL || count == 0) return NULL;
+    if (pmm_frames == NULL || count == 0) return NULL;
+    if (count == 1) return pmm_alloc_frame();
+
+    uint8_t order = pmm_order_for(count);
 
     uint64_t f = spin_irq_save();
     spin_lock(&pmm_lock_);
 
-    uint64_t* bitmap64 = (uint64_t*)bitmap;
-    uint64_t num_qwords = bitmap_size / 8;
-
-    for (uint64_t i = 0; i < num_qwords; i++) {
-        // Skip 64 frames at once if the entire QWORD is fully occupied.
-        // This significantly reduces lock contention in SMP environments.
-        if (bitmap64[i] == 0xFFFFFFFFFFFFFFFF) continue;
-
-        // Checking bits inside this QWORD
-        for (int b = 0; b < 64; b++) {
-            uint64_t start_bit_idx = i * 64 + b;
-            uint64_t free_found = 0;
-
-            // Looking for free frames
-            for (uint64_t j = 0; j < count; j++) {
-                uint64_t current_bit = start_bit_idx + j;
-                if (current_bit >= bitmap_size * 8) break;
-
-                if (!(bitmap[current_bit / 8] & (1 << (current_bit % 8)))) {
-                    free_found++;
-                } else {
-                    break;
-                }
-            }
+    uint64_t idx, taken;
+    if (order > PMM_MAX_ORDER) {
+        uint64_t blocks = (count + (1ULL << PMM_MAX_ORDER) - 1) >> PMM_MAX_ORDER;
+        idx   = buddy_alloc_large(blocks);
+        taken = blocks << PMM_MAX_ORDER;
+    } else {
+        idx   = buddy_alloc(order);
+        taken = 1ULL << order;
+    }
 
-            if (free_found == count) {
-                // Success 
-                for (uint64_t j = 0; j < count; j++) {
-                    uint64_t target_bit = start_bit_idx + j;
-                    bitmap[target_bit / 8] |= (1 << (target_bit % 8));
-                }
-
-                uint64_t phys_addr = start_bit_idx * PAGE_SIZE;
-                
-                spin_unlock(&pmm_lock_);
-                spin_irq_restore(f);
-                return (void*)phys_addr;
-            }
-        }
+    if (idx != PMM_NO_FRAME && taken > count) {
+        buddy_free_range(idx + count, taken - count);
     }
 
     spin_unlock(&pmm_lock_);
     spin_irq_restore(f);
 
-    return NULL;
+    if (idx == PMM_NO_FRAME) return NULL;
+    return (void*)(idx * PAGE_SIZE);
 }
 
 void pmm_free_frame(void* frame) {
-if (!frame) return;
+    if (!frame) return;
 
-    uint64_t f = spin_irq_save();
-    spin_lock(&pmm_lock_);
+    uint64_t idx = (uint64_t)frame / PAGE_SIZE;
+    if (idx >= pmm_frame_count) return;
 
-    uint64_t addr = (uint64_t)frame;
-    pmm_unset_frame(addr);
+    uint64_t f = spin_irq_save();
 
-    cpu_context_t* cpu = get_cpu();
-    uint64_t frame_index = (addr / PAGE_SIZE) / 8;
-    
-    if (cpu && frame_index < cpu->pmm_last_index) {
-        cpu->pmm_last_index = frame_index;
+    pmm_cache_t* pc = pmm_local_cache();
+    if (pc) {
+        if (pc->count == PMM_CACHE_HIGH) pmm_cache_drain(pc);
+        pc->frames[pc->count++] = idx;
+    } else {
+        spin_lock(&pmm_lock_);
+        buddy_free(idx, 0);
+        spin_unlock(&pmm_lock_);
     }
 
+    spin_irq_restore(f);
+}
+
+/*
+ * Releases a run of frames previously returned by pmm_alloc_frames().
+ */
+void pmm_free_frames(void* frame, size_t count) {
+    if (!frame || count == 0) return;
+
+    uint64_t idx = (uint64_t)frame / PAGE_SIZE;
+    if (idx + count > pmm_frame_count) return;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&pmm_lock_);
+
+    buddy_free_range(idx, count);
+
     spin_unlock(&pmm_lock_);
     spin_irq_restore(f);
 }
 
 /*
- * Adjusts the bitmap pointer to use the Higher Half Direct Map (HHDM) address.
- * This must be called after the virtual memory manager is initialized and 
+ * FRAME REFERENCE COUNTS
+ * A frame returned by the allocator has a single owner and refs == 0.
+ * Sharing it (e.g. copy-on-write after fork) adds owners with pmm_frame_get(),
+ * and every owner drops its claim with pmm_frame_put(). The last put frees it.
+ */
+void pmm_frame_get(uintptr_t phys) {
+    uint64_t idx = phys / PAGE_SIZE;
+    if (idx >= pmm_frame_count) return;
+
+    __atomic_fetch_add(&pmm_frames[idx].refs, 1, __ATOMIC_RELAXED);
+}
+
+void pmm_frame_put(uintptr_t phys) {
+    uint64_t idx = phys / PAGE_SIZE;
+    if (idx >= pmm_frame_count) return;
+
+    uint16_t refs = __atomic_load_n(&pmm_frames[idx].refs, __ATOMIC_ACQUIRE);
+    while (refs > 0) {
+        if (__atomic_compare_exchange_n(&pmm_frames[idx].refs, &refs, refs - 1,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+
+    pmm_free_frame((void*)(idx * PAGE_SIZE));
+}
+
+uint16_t pmm_frame_refs(uintptr_t phys) {
+    uint64_t idx = phys / PAGE_SIZE;
+    if (idx >= pmm_frame_count) return 0;
+
+    return __atomic_load_n(&pmm_frames[idx].refs, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Frames parked in per-CPU caches are not included.
+ */
+uint64_t pmm_get_free_count() {
+    return free_frames;
+}
+
+/*
+ * Adjusts the frame array pointer to use the Higher Half Direct Map (HHDM) address.
+ * This must be called after the virtual memory manager is initialized and
  * CR3 is loaded, allowing the PMM to be accessible in virtual address space.
  */
 void pmm_move_to_high_half() {
-    if (bitmap != NULL && (uintptr_t)bitmap < HHDM_OFFSET) {
-        bitmap = (uint8_t*)phys_to_virt((uintptr_t)bitmap);
+    if (pmm_frames != NULL && (uintptr_t)pmm_frames < HHDM_OFFSET) {
+        pmm_frames = (pmm_frame_t*)phys_to_virt((uintptr_t)pmm_frames);
     }
 }
@@ -1,13 +1,31 @@
 #include <slab.h>
 #include <pmm.h>
 #include <vmm.h>
+#include <cpu.h>
 #include <panic.h>
+#include <serial.h>
+#include <std_funcs.h>
 
 #define NUM_KMALLOC_CACHES 8
 
 static slab_cache_t kmalloc_caches[NUM_KMALLOC_CACHES];
 static size_t cache_sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 
+/* Magazines are slab objects too, from a cache that never uses magazines */
+static slab_cache_t magazine_cache;
+
+/* Set once GS points at a valid cpu_context_t */
+static bool magazines_online = false;
+
+/* Caches created through kmem_cache_create() */
+static slab_cache_t* cache_list = NULL;
+static spinlock_t cache_list_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };
+
+_Static_assert(sizeof(slab_cache_t) <= PAGE_SIZE, "slab_cache_t must fit the frame kmem_cache_create() gives it");
+
+static void* slab_layer_alloc(slab_cache_t* cache);
+static void slab_layer_free(slab_cache_t* cache, void* ptr);
+
 /*
  * INTERNAL HELPERS
  */
@@ -37,11 +55,10 @@ void slab_grow(slab_cache_t* cache) {
     slab->magic = SLAB_MAGIC;
     slab->parent_cache = cache;
     
-    uintptr_t start = virt + sizeof(slab_t);
-    start = (start + 15) & ~15;  // Optional align
+    uintptr_t start = virt + cache->obj_offset;
 
     slab->free_list = (slab_obj_t*)start;
-    size_t max_objs = (virt + 4096 - start) / cache->obj_size;
+    size_t max_objs = cache->objs_per_slab;
     slab->free_count = max_objs;
 
     // Merge objects (Free List)
@@ -55,20 +72,185 @@ void slab_grow(slab_cache_t* cache) {
     slab_list_push(&cache->empty_slabs, slab);
 }
 
+static void slab_cache_setup(slab_cache_t* cache, const char* name, size_t obj_size,
+                             size_t align, void (*ctor)(void*), uint32_t flags) {
+    memset(cache, 0, sizeof(slab_cache_t));
+    cache->name = name;
+    cache->obj_size = (obj_size + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->obj_offset = (sizeof(slab_t) + align - 1) & ~(align - 1);
+    cache->objs_per_slab = (PAGE_SIZE - cache->obj_offset) / cache->obj_size;
+    cache->ctor = ctor;
+    cache->flags = flags;
+    cache->lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+    cache->depot_lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+}
+
 void slab_init() {
+    slab_cache_setup(&magazine_cache, "slab_magazine", sizeof(slab_magazine_t), 16, NULL, SLAB_NO_MAGAZINES);
+
     for (int i = 0; i < NUM_KMALLOC_CACHES; i++) {
-        kmalloc_caches[i].name = "kmalloc_cache";
-        kmalloc_caches[i].obj_size = cache_sizes[i];
-        kmalloc_caches[i].partial_slabs = NULL;
-        kmalloc_caches[i].full_slabs = NULL;
-        kmalloc_caches[i].empty_slabs = NULL;
-        kmalloc_caches[i].lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+        slab_cache_setup(&kmalloc_caches[i], "kmalloc_cache", cache_sizes[i], 16, NULL, 0);
         
         // Optional: starting with ready to use objects
         slab_grow(&kmalloc_caches[i]);
     }
 }
 
+/*
+ * Creates a cache of objects of exactly 'size' bytes, aligned to 'align'
+ * (a power of two, 0 for the default 16). Objects are packed densely in
+ * 4KB slabs and served through the per-CPU magazines like kmalloc caches.
+ * 'ctor' (optional) prepares an object on every kmem_cache_alloc(),
+ * without it the object is zeroed. Returns NULL if objects don't fit a slab.
+ */
+slab_cache_t* kmem_cache_create(const char* name, size_t size, size_t align, void (*ctor)(void*)) {
+    if (align < sizeof(slab_obj_t)) align = 16;
+    if (align & (align - 1)) return NULL;
+    if (size < sizeof(slab_obj_t)) size = sizeof(slab_obj_t);
+
+    size_t offset = (sizeof(slab_t) + align - 1) & ~(align - 1);
+    size_t stride = (size + align - 1) & ~(align - 1);
+    if (offset + stride > PAGE_SIZE) return NULL;
+
+    // The descriptor holds per-CPU state aligned to cache lines, give it its own frame
+    void* frame = pmm_alloc_frame();
+    if (!frame) return NULL;
+    slab_cache_t* cache = (slab_cache_t*)phys_to_virt((uintptr_t)frame);
+
+    slab_cache_setup(cache, name, size, align, ctor, 0);
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&cache_list_lock_);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock(&cache_list_lock_);
+    spin_irq_restore(f);
+
+    return cache;
+}
+
+void* kmem_cache_alloc(slab_cache_t* cache) {
+    void* obj = slab_cache_alloc(cache);
+    if (!obj) return NULL;
+
+    if (cache->ctor) cache->ctor(obj);
+    else memset(obj, 0, cache->obj_size);
+
+    return obj;
+}
+
+void kmem_cache_free(slab_cache_t* cache, void* obj) {
+    if (!obj) return;
+    slab_cache_free(cache, obj);
+}
+
+/*
+ * Called by the BSP once GS is valid (after cpu_init_context).
+ * Before that every object goes straight through the locked slab lists.
+ */
+void slab_magazines_enable() {
+    __atomic_store_n(&magazines_online, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * MAGAZINE DEPOT
+ * Full and empty magazines not owned by any CPU. Exchanging a whole
+ * magazine amortizes one lock acquisition over SLAB_MAG_SIZE objects.
+ */
+static slab_magazine_t* depot_pop(slab_cache_t* cache, slab_magazine_t** list) {
+    spin_lock(&cache->depot_lock);
+    slab_magazine_t* mag = *list;
+    if (mag) *list = mag->next;
+    spin_unlock(&cache->depot_lock);
+    return mag;
+}
+
+static void depot_push(slab_cache_t* cache, slab_magazine_t** list, slab_magazine_t* mag) {
+    spin_lock(&cache->depot_lock);
+    mag->next = *list;
+    *list = mag;
+    spin_unlock(&cache->depot_lock);
+}
+
+static slab_magazine_t* magazine_new() {
+    slab_magazine_t* mag = slab_layer_alloc(&magazine_cache);
+    if (mag) {
+        mag->rounds = 0;
+        mag->next = NULL;
+    }
+    return mag;
+}
+
+static inline void magazine_swap(slab_cpu_cache_t* pcc) {
+    slab_magazine_t* tmp = pcc->loaded;
+    pcc->loaded = pcc->previous;
+    pcc->previous = tmp;
+}
+
+/*
+ * Fast path: pop from the CPU's loaded magazine, then from the previous one.
+ * When both are empty, trade the empty one for a full magazine from the depot.
+ * Caller has IRQs disabled. Returns NULL if the slab lists must be used.
+ */
+static void* magazine_alloc(slab_cache_t* cache, slab_cpu_cache_t* pcc) {
+    if (pcc->loaded && pcc->loaded->rounds > 0) {
+        pcc->alloc_hits++;
+        return pcc->loaded->objs[--pcc->loaded->rounds];
+    }
+
+    if (pcc->previous && pcc->previous->rounds > 0) {
+        magazine_swap(pcc);
+        pcc->alloc_hits++;
+        return pcc->loaded->objs[--pcc->loaded->rounds];
+    }
+
+    pcc->alloc_misses++;
+
+    slab_magazine_t* full = depot_pop(cache, &cache->depot_full);
+    if (!full) return NULL;
+
+    // Both magazines are empty here: park one in the depot, keep the other
+    if (pcc->previous) depot_push(cache, &cache->depot_empty, pcc->previous);
+    pcc->previous = pcc->loaded;
+    pcc->loaded = full;
+
+    return pcc->loaded->objs[--pcc->loaded->rounds];
+}
+
+/*
+ * Fast path: push onto the loaded magazine, or onto the previous one if it is empty.
+ * When both are full, hand a full magazine to the depot and start an empty one.
+ * Caller has IRQs disabled. Returns false if the object must go to the slab lists.
+ */
+static bool magazine_free(slab_cache_t* cache, slab_cpu_cache_t* pcc, void* ptr) {
+    if (pcc->loaded && pcc->loaded->rounds < SLAB_MAG_SIZE) {
+        pcc->loaded->objs[pcc->loaded->rounds++] = ptr;
+        pcc->free_hits++;
+        return true;
+    }
+
+    if (pcc->previous && pcc->previous->rounds == 0) {
+        magazine_swap(pcc);
+        pcc->loaded->objs[pcc->loaded->rounds++] = ptr;
+        pcc->free_hits++;
+        return true;
+    }
+
+    pcc->free_misses++;
+
+    slab_magazine_t* empty = depot_pop(cache, &cache->depot_empty);
+    if (!empty) empty = magazine_new();
+    if (!empty) return false;
+
+    if (pcc->previous) depot_push(cache, &cache->depot_full, pcc->previous);
+    pcc->previous = pcc->loaded;
+    pcc->loaded = empty;
+
+    pcc->loaded->objs[pcc->loaded->rounds++] = ptr;
+    return true;
+}
+
 void* slab_alloc(size_t size) {
     // 1. Find cache with enough space
     for (int i = 0; i < NUM_KMALLOC_CACHES; i++) {
@@ -97,7 +279,36 @@ void slab_free(void* ptr) {
     slab_cache_free(slab->parent_cache, ptr);
 }
 
+/*
+ * Allocates one object, from the CPU's magazines when possible.
+ */
 void* slab_cache_alloc(slab_cache_t* cache) {
+    if (__atomic_load_n(&magazines_online, __ATOMIC_ACQUIRE) && !(cache->flags & SLAB_NO_MAGAZINES)) {
+        uint64_t f = spin_irq_save();
+        void* obj = magazine_alloc(cache, &cache->cpu[get_cpu()->cpu_id]);
+        spin_irq_restore(f);
+        if (obj) return obj;
+    }
+
+    return slab_layer_alloc(cache);
+}
+
+void slab_cache_free(slab_cache_t* cache, void* ptr) {
+    if (__atomic_load_n(&magazines_online, __ATOMIC_ACQUIRE) && !(cache->flags & SLAB_NO_MAGAZINES)) {
+        uint64_t f = spin_irq_save();
+        bool cached = magazine_free(cache, &cache->cpu[get_cpu()->cpu_id], ptr);
+        spin_irq_restore(f);
+        if (cached) return;
+    }
+
+    slab_layer_free(cache, ptr);
+}
+
+/*
+ * SLAB LAYER
+ * Object free lists inside pages, protected by the cache-wide lock.
+ */
+static void* slab_layer_alloc(slab_cache_t* cache) {
     uint64_t f = spin_irq_save();
     spin_lock(&cache->lock);
 
@@ -131,7 +342,7 @@ void* slab_cache_alloc(slab_cache_t* cache) {
     return (void*)obj;
 }
 
-void slab_cache_free(slab_cache_t* cache, void* ptr) {
+static void slab_layer_free(slab_cache_t* cache, void* ptr) {
     // Get page with "to free" object 
     slab_t* slab = (slab_t*)((uintptr_t)ptr & ~0xFFF); // Align
 
@@ -145,7 +356,7 @@ void slab_cache_free(slab_cache_t* cache, void* ptr) {
     slab->free_count++;
 
     // Move slab to appropriate list based on occupancy
-    size_t max_objs = (4096 - sizeof(slab_t)) / cache->obj_size;
+    size_t max_objs = cache->objs_per_slab;
 
     if (slab->free_count == 1) {
         slab_list_remove(&cache->full_slabs, slab);
@@ -159,3 +370,33 @@ void slab_cache_free(slab_cache_t* cache, void* ptr) {
     spin_unlock(&cache->lock);
     spin_irq_restore(f);
 }
+
+/* DIAGNOSTIC */
+static void slab_dump_cache(slab_cache_t* cache) {
+    uint64_t hits = 0, misses = 0;
+
+    for (int c = 0; c < SLAB_MAX_CPUS; c++) {
+        hits   += cache->cpu[c].alloc_hits + cache->cpu[c].free_hits;
+        misses += cache->cpu[c].alloc_misses + cache->cpu[c].free_misses;
+    }
+
+    uint64_t total = hits + misses;
+    kprintf("%s %d: hits %d misses %d (%d%%)\n", cache->name, cache->obj_size,
+            hits, misses, total ? (hits * 100) / total : 0);
+}
+
+void slab_dump_stats() {
+    kprintf("\n----- SLAB MAGAZINES -----\n");
+    for (int i = 0; i < NUM_KMALLOC_CACHES; i++) {
+        slab_dump_cache(&kmalloc_caches[i]);
+    }
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&cache_list_lock_);
+    for (slab_cache_t* cache = cache_list; cache; cache = cache->next) {
+        slab_dump_cache(cache);
+    }
+    spin_unlock(&cache_list_lock_);
+    spin_irq_restore(f);
+    kprintf("--------------------------\n");
+}
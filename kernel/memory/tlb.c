@@ -0,0 +1,177 @@
+#include <tlb.h>
+#include <vmm.h>
+#include <pmm.h>
+#include <cpu.h>
+#include <apic.h>
+#include <atomic.h>
+
+/*
+ * The shootdown in flight. Only one round runs at a time,
+ * 'tlb_pending' holds the CPUs that have not acknowledged it yet.
+ */
+static spinlock_t tlb_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };
+
+static volatile uintptr_t tlb_req_cr3;
+static volatile uintptr_t tlb_req_start;
+static volatile uintptr_t tlb_req_end;
+static volatile uint32_t  tlb_pending = 0;
+
+#define TLB_ALL_SLOTS ((1U << CPU_PCID_SLOTS) - 1)
+
+static inline bool tlb_is_kernel(uintptr_t start) {
+    return start >= TLB_KERNEL_HALF;
+}
+
+/*
+ * Drops [start, end) from the TLB of the calling CPU if it is running 'cr3'.
+ * invlpg only reaches the current PCID, kernel ranges therefore also retire
+ * every other PCID slot of this CPU.
+ */
+static void tlb_flush_local(uintptr_t cr3, uintptr_t start, uintptr_t end) {
+    cpu_context_t* cpu = get_cpu();
+    bool kernel = tlb_is_kernel(start);
+
+    if (kernel || cr3 == cpu->active_cr3) {
+        if ((end - start) / PAGE_SIZE > TLB_FLUSH_MAX_PAGES) {
+            cpu_flush_tlb();
+        } else {
+            for (uintptr_t va = start; va < end; va += PAGE_SIZE) {
+                vmm_invlpg((void*)va);
+            }
+        }
+    }
+
+    if (kernel) __atomic_fetch_or(&cpu->pcid_stale, TLB_ALL_SLOTS, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Retires the PCID slots of 'cpu' that may cache 'cr3' and reports
+ * whether the CPU is running it right now (and so needs an IPI).
+ * The stale mark is published before 'active_cr3' is read, mirroring
+ * vmm_switch_address_space(): a CPU switching in either gets the IPI or
+ * sees the mark before reusing the PCID.
+ */
+static bool tlb_mark_cpu(cpu_context_t* cpu, uintptr_t cr3, bool kernel) {
+    uint32_t stale = 0;
+
+    if (kernel) {
+        stale = TLB_ALL_SLOTS;
+    } else {
+        for (uint32_t i = 0; i < CPU_PCID_SLOTS; i++) {
+            if (cpu->pcid_cr3[i] == cr3) stale |= 1U << i;
+        }
+    }
+
+    if (stale) __atomic_fetch_or(&cpu->pcid_stale, stale, __ATOMIC_SEQ_CST);
+
+    return kernel || __atomic_load_n(&cpu->active_cr3, __ATOMIC_SEQ_CST) == cr3;
+}
+
+/*
+ * Handles the shootdown addressed to this CPU, if any.
+ * Called from the IPI_VECTOR_TLB handler and by CPUs spinning for their own round,
+ * so two CPUs shooting at each other with IRQs off cannot deadlock.
+ */
+void tlb_shootdown_service() {
+    uint32_t bit = 1U << get_cpu()->cpu_id;
+
+    if (!(__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & bit)) return;
+
+    tlb_flush_local(tlb_req_cr3, tlb_req_start, tlb_req_end);
+    __atomic_fetch_and(&tlb_pending, ~bit, __ATOMIC_RELEASE);
+}
+
+/*
+ * Invalidates [start, end) of the address space 'cr3' on every CPU that may cache it.
+ * Only CPUs currently running it receive an IPI, the others just lose the PCID slot.
+ * Kernel-half ranges reach every CPU. Returns once all targets have flushed,
+ * so frames unmapped before the call may be freed afterwards.
+ * Must not be called with a spinlock held.
+ */
+void tlb_shootdown(uintptr_t cr3, uintptr_t start, uintptr_t end) {
+    if (start >= end) return;
+
+    cr3 &= VMM_ADDR_MASK;
+    start = PAGE_ALIGN_DOWN(start);
+
+    // Before the LAPIC is up only the BSP runs
+    if (!g_lock_enabled) {
+        cpu_flush_tlb();
+        return;
+    }
+
+    uint64_t f = spin_irq_save();
+    cpu_context_t* self = get_cpu();
+    bool kernel = tlb_is_kernel(start);
+
+    uint32_t targets = 0;
+    for (uint32_t i = 0; i < 32; i++) {
+        cpu_context_t* cpu = cpu_table[i];
+        if (!cpu || cpu == self) continue;
+
+        if (tlb_mark_cpu(cpu, cr3, kernel)) targets |= 1U << i;
+    }
+
+    // Our own idle slots may cache it as well
+    tlb_mark_cpu(self, cr3, kernel);
+    tlb_flush_local(cr3, start, end);
+
+    if (targets) {
+        while (!spin_trylock(&tlb_lock_)) {
+            tlb_shootdown_service();
+            __asm__ volatile("pause");
+        }
+
+        tlb_req_cr3   = cr3;
+        tlb_req_start = start;
+        tlb_req_end   = end;
+        __atomic_store_n(&tlb_pending, targets, __ATOMIC_RELEASE);
+
+        for (uint32_t i = 0; i < 32; i++) {
+            if (targets & (1U << i)) lapic_send_ipi(cpu_table[i]->lapic_id, IPI_VECTOR_TLB);
+        }
+
+        while (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) != 0) {
+            __asm__ volatile("pause");
+        }
+
+        spin_unlock(&tlb_lock_);
+    }
+
+    spin_irq_restore(f);
+}
+
+/*
+ * BATCHED UNMAPS
+ * Callers clear page table entries one by one and queue them here.
+ * The frames are only handed back to the PMM after the shootdown,
+ * when no CPU can still reach them through a stale translation.
+ */
+void tlb_batch_init(tlb_batch_t* batch, uintptr_t cr3) {
+    batch->cr3   = cr3;
+    batch->start = UINTPTR_MAX;
+    batch->end   = 0;
+    batch->count = 0;
+}
+
+void tlb_batch_add(tlb_batch_t* batch, uintptr_t virt, uintptr_t frame) {
+    if (virt < batch->start) batch->start = virt;
+    if (virt + PAGE_SIZE > batch->end) batch->end = virt + PAGE_SIZE;
+
+    if (!frame) return;
+
+    // Out of room: flush early, 'virt' is already part of the range
+    if (batch->count == TLB_BATCH_FRAMES) tlb_batch_flush(batch);
+
+    batch->frames[batch->count++] = frame;
+}
+
+void tlb_batch_flush(tlb_batch_t* batch) {
+    if (batch->start < batch->end) tlb_shootdown(batch->cr3, batch->start, batch->end);
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        pmm_frame_put(batch->frames[i]);
+    }
+
+    tlb_batch_init(batch, batch->cr3);
+}
@@ -0,0 +1,87 @@
+#include <vdso.h>
+#include <sched.h>
+#include <timer.h>
+#include <smp.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <vma.h>
+#include <panic.h>
+#include <std_funcs.h>
+
+vdso_data_t* vdso = NULL;
+
+static uintptr_t  vdso_phys  = 0;
+static spinlock_t vdso_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };   // Clock writers
+
+/*
+ * Allocates the vDSO page and fills it. Called once after the PMM and
+ * HHDM are up, before the first user task is spawned.
+ */
+void vdso_init() {
+    void* frame = pmm_alloc_frame();
+    if (!frame) kpanic("VDSO: Failed to allocate the data page!");
+
+    vdso_phys = (uintptr_t)frame;
+    vdso = (vdso_data_t*)phys_to_virt(vdso_phys);
+    memset(vdso, 0, PAGE_SIZE);
+
+    vdso_update();
+}
+
+/*
+ * Copies the clocksource and CPU count into the page. Readers retry while
+ * 'seq' is odd or moved under them, so they never see a half-written clock.
+ * Called whenever the clocksource or the CPU count changes (calibration,
+ * AP bring-up). Without RDTSCP the CPU id cannot be read from Ring 3.
+ */
+void vdso_update() {
+    if (!vdso) return;
+
+    uint32_t flags = 0;
+    if (clocksource.rdtscp) {
+        uint32_t eax, ebx, ecx, edx;
+        flags |= VDSO_RDTSCP;
+
+        cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        if (eax >= 7) {
+            cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+            if ((ecx >> 22) & 1) flags |= VDSO_RDPID;
+        }
+    }
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&vdso_lock_);
+
+    __atomic_store_n(&vdso->seq, vdso->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    vdso->flags     = flags;
+    vdso->tsc_base  = clocksource.tsc_base;
+    vdso->mult      = clocksource.mult;
+    vdso->cpu_count = get_cpu_count_test();
+    for (int i = 0; i < VDSO_MAX_CPUS && i < CLOCK_MAX_CPUS; i++) {
+        vdso->offset[i] = clocksource.offset[i];
+    }
+
+    __atomic_store_n(&vdso->seq, vdso->seq + 1, __ATOMIC_RELEASE);
+
+    spin_unlock(&vdso_lock_);
+    spin_irq_restore(f);
+}
+
+/*
+ * Maps the vDSO page read-only at VDSO_BASE in the address space of 't'.
+ * Each mapping owns a reference, so exit and fork treat it like any other
+ * shared frame, and the kernel's own reference keeps it alive.
+ * Returns 0 on success.
+ */
+int vdso_map(struct task* t) {
+    if (!vdso) return -1;
+    if (vma_map(t, VDSO_BASE, PAGE_SIZE, VMA_READ | VMA_USER | VMA_SHARED) != 0) return -1;
+
+    pmm_frame_get(vdso_phys);
+    vmm_map(vmm_get_table(t->cr3), VDSO_BASE, vdso_phys, PTE_PRESENT | PTE_USER | PTE_NX);
+    return 0;
+}
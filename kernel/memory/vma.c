@@ -1,14 +1,21 @@
 #include <vma.h>
 #include <sched.h>
 #include <kmalloc.h>
+#include <slab.h>
+#include <panic.h>
 #include <vmm.h>
 #include <pmm.h>
+#include <tlb.h>
 #include <atomic.h>
 #include <std_funcs.h>
 
 /*
  * Internal Red/Black helpers
  */
+/* Dedicated caches for VMA descriptors and address spaces */
+static slab_cache_t* vma_cache = NULL;
+static slab_cache_t* mm_cache  = NULL;
+
 static void vma_rotate_left(struct task* t, vma_area_t* x) {
     vma_area_t* y = x->right;
     x->right = y->left;
@@ -16,7 +23,7 @@ static void vma_rotate_left(struct task* t, vma_area_t* x) {
     if (y->left) y->left->parent = x;
     y->parent = x->parent;
     
-    if (!x->parent) t->vma_tree_root = y;
+    if (!x->parent) t->mm->vma_tree_root = y;
     else if (x == x->parent->left) x->parent->left = y;
     else x->parent->right = y;
     
@@ -31,7 +38,7 @@ static void vma_rotate_right(struct task* t, vma_area_t* y) {
     if (x->right) x->right->parent = y;
     x->parent = y->parent;
     
-    if (!y->parent) t->vma_tree_root = x;
+    if (!y->parent) t->mm->vma_tree_root = x;
     else if (y == y->parent->right) y->parent->right = x;
     else y->parent->left = x;
     
@@ -77,30 +84,181 @@ static void vma_insert_fixup(struct task* t, vma_area_t* z) {
             }
         }
     }
-    t->vma_tree_root->color = VMA_BLACK;
+    t->mm->vma_tree_root->color = VMA_BLACK;
+}
+
+/*
+ * Links a zeroed descriptor into the task's list and RB-Tree.
+ * Caller holds t->mm->vma_mutex (or owns a task nobody else can see yet).
+ */
+static void vma_insert(struct task* t, vma_area_t* new_vma) {
+    new_vma->color = VMA_RED; // New nodes are always red
+
+    // Linked List Insertion (Keep it for easy iteration/destruction)
+    new_vma->next = t->mm->vma_list_head;
+    if (t->mm->vma_list_head) t->mm->vma_list_head->prev = new_vma;
+    t->mm->vma_list_head = new_vma;
+
+    // RB-Tree Insertion
+    if (!t->mm->vma_tree_root) {
+        t->mm->vma_tree_root = new_vma;
+    } else {
+        vma_area_t* node = t->mm->vma_tree_root;
+        while (1) {
+            if (new_vma->vm_start < node->vm_start) {
+                if (!node->left) { node->left = new_vma; new_vma->parent = node; break; }
+                node = node->left;
+            } else {
+                if (!node->right) { node->right = new_vma; new_vma->parent = node; break; }
+                node = node->right;
+            }
+        }
+    }
+
+    // Rebalance the Tree
+    vma_insert_fixup(t, new_vma);
+
+    t->mm->vma_count++;
 }
 
 /*
- * Initializes VMA-related fields for a new task.
+ * Translates VMA permissions into page table flags.
+ */
+static uint64_t vma_pte_flags(uint32_t flags) {
+    uint64_t vmm_opts = PTE_PRESENT | PTE_USER;
+    if (flags & VMA_WRITE) vmm_opts |= PTE_WRITABLE;
+    if (!(flags & VMA_EXEC)) vmm_opts |= PTE_NX;
+    return vmm_opts;
+}
+
+/*
+ * Backs a single page of 'vma' with a fresh zeroed frame.
+ * Caller holds t->mm->vma_mutex. Returns the physical address or 0.
+ */
+static uintptr_t vma_populate_page(struct task* t, vma_area_t* vma, uintptr_t addr) {
+    page_table_t* pml4 = vmm_get_table(t->mm->cr3);
+    uintptr_t page = addr & ~0xFFFULL;
+
+    // Another CPU may have resolved the same fault while we waited for the mutex
+    uintptr_t phys = vmm_virtual_to_physical(pml4, page);
+    if (phys) return phys;
+
+    void* frame = pmm_alloc_frame();
+    if (!frame) return 0;
+
+    // Security: never hand out stale data from other processes or the kernel
+    memset((void*)phys_to_virt((uintptr_t)frame), 0, PAGE_SIZE);
+    vmm_map(pml4, page, (uintptr_t)frame, vma_pte_flags(vma->vm_flags));
+
+    return (uintptr_t)frame;
+}
+
+/*
+ * Resolves a write to a copy-on-write page of 'vma'.
+ * If the frame lost all its other owners the page is simply made writable again,
+ * otherwise its content is copied into a private frame and the shared one is released.
+ * Caller holds t->mm->vma_mutex. Returns the physical address or 0.
+ */
+static uintptr_t vma_cow_page(struct task* t, vma_area_t* vma, uintptr_t addr) {
+    page_table_t* pml4 = vmm_get_table(t->mm->cr3);
+    uintptr_t page = addr & ~0xFFFULL;
+
+    pt_entry pte = vmm_get_entry(pml4, page);
+    if (!(pte & PTE_PRESENT)) return vma_populate_page(t, vma, addr);
+    if (pte & PTE_WRITABLE) return pte & VMM_ADDR_MASK; // Already resolved
+    if (!(pte & PTE_COW)) return 0;
+
+    uintptr_t shared = pte & VMM_ADDR_MASK;
+    uint64_t flags = vma_pte_flags(vma->vm_flags);
+
+    // Last owner: take the frame back without copying
+    if (pmm_frame_refs(shared) == 0) {
+        vmm_map(pml4, page, shared, flags);
+        return shared;
+    }
+
+    void* frame = pmm_alloc_frame();
+    if (!frame) return 0;
+
+    memcpy((void*)phys_to_virt((uintptr_t)frame), (void*)phys_to_virt(shared), PAGE_SIZE);
+    vmm_map(pml4, page, (uintptr_t)frame, flags);
+    pmm_frame_put(shared);
+
+    return (uintptr_t)frame;
+}
+
+/*
+ * Creates the VMA descriptor and address space caches. Called once after kmalloc_init().
+ */
+void vma_init() {
+    vma_cache = kmem_cache_create("vma_area_t", sizeof(vma_area_t), _Alignof(vma_area_t), NULL);
+    if (!vma_cache) kpanic("VMA: Failed to create descriptor cache!");
+
+    mm_cache = kmem_cache_create("mm_t", sizeof(mm_t), _Alignof(mm_t), NULL);
+    if (!mm_cache) kpanic("VMA: Failed to create address space cache!");
+}
+
+/*
+ * A new task starts without an address space. Kernel tasks keep it that
+ * way; user tasks get one from mm_create() or share one with mm_get().
  * Called during task_alloc_base() form context.c.
  */
 void vma_init_task(struct task* t) {
-    t->vma_tree_root = NULL;
-    t->vma_list_head = NULL;
-    t->vma_count = 0;
-    t->vma_mutex = (mutex_t){
-        .count = 1,
-        .wait_lock = { .ticket = 0, .current = 0, .last_cpu = -1 },
-        .wait_list = NULL,
-        .owner     = NULL
-    };
+    t->mm = NULL;
+}
+
+/*
+ * Wraps the user page tables 'cr3' in an empty address space with a single
+ * user. Returns NULL if out of memory.
+ */
+mm_t* mm_create(uintptr_t cr3) {
+    mm_t* mm = kmem_cache_alloc(mm_cache);
+    if (!mm) return NULL;
+
+    mm->cr3 = cr3;
+    mm->vma_tree_root = NULL;
+    mm->vma_list_head = NULL;
+    mm->vma_count = 0;
+    mm->vma_mutex  = (mutex_t){ .count = 1, .waiters = WAIT_QUEUE_INIT, .owner = NULL };
+    mm->heap_mutex = (mutex_t){ .count = 1, .waiters = WAIT_QUEUE_INIT, .owner = NULL };
+    mm->ring_mutex = (mutex_t){ .count = 1, .waiters = WAIT_QUEUE_INIT, .owner = NULL };
+    mm->heap_start = 0;
+    mm->heap_curr  = 0;
+    mm->heap_end   = 0;
+    mm->has_ring   = false;
+    mm->users      = 1;
+
+    return mm;
+}
+
+/* Adds a task (a new thread) to the users of 'mm' */
+void mm_get(mm_t* mm) {
+    __atomic_fetch_add(&mm->users, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drops one user. The last one releases every VMA descriptor, the page
+ * tables and the frames they map, then the mm itself.
+ */
+void mm_put(mm_t* mm) {
+    if (__atomic_sub_fetch(&mm->users, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    vma_area_t* curr = mm->vma_list_head;
+    while (curr) {
+        vma_area_t* next = curr->next;
+        kmem_cache_free(vma_cache, curr);
+        curr = next;
+    }
+
+    if (mm->cr3 != 0) vmm_destroy_user_pml4(mm->cr3, true);
+    kmem_cache_free(mm_cache, mm);
 }
 
 /*
  * Searches the RB-Tree for an area containing 'addr'.
  */
 vma_area_t* vma_find(struct task* t, uintptr_t addr) {
-    vma_area_t* curr = t->vma_tree_root;
+    vma_area_t* curr = t->mm->vma_tree_root;
 
     while (curr) {
         if (addr >= curr->vm_start && addr < curr->vm_end)
@@ -115,15 +273,13 @@ vma_area_t* vma_find(struct task* t, uintptr_t addr) {
 }
 
 /*
- * High-level mapping function:
+ * High-level mapping function. Only reserves the virtual range, physical
+ * frames are allocated one page at a time by vma_handle_fault() on first access.
  * 1. Attempts VMA Merging: If the new range is adjacent to an existing VMA with 
  * matching flags, it expands the existing one to save memory and tree nodes.
  * 2. Overlap Check: Ensures the requested virtual range is not already occupied.
  * 3. Allocation: If merging fails, allocates a new VMA descriptor via kmalloc.
- * 4. Physical Backing: Allocates physical frames via PMM and maps them into 
- * the task's specific PML4.
- * 5. Security: Zeroes out new memory to prevent information leakage.
- * 6. RB-Tree Integration: Inserts the new VMA into the balanced Red-Black Tree 
+ * 4. RB-Tree Integration: Inserts the new VMA into the balanced Red-Black Tree 
  * and performs a fixup to maintain O(log n) search complexity.
  */
 int vma_map(struct task* t, uintptr_t addr, size_t size, uint32_t flags) {
@@ -133,106 +289,132 @@ int vma_map(struct task* t, uintptr_t addr, size_t size, uint32_t flags) {
     size = (size + 0xFFF) & ~0xFFFULL;
     if (addr & 0xFFF) return -1;
 
-    mutex_lock(&t->vma_mutex);
+    mutex_lock(&t->mm->vma_mutex);
 
     // 1. VMA Merging (Expansion Logic)
     // Check if we can just expand an existing VMA (usually the heap)
     // This prevents fragmentation of VMA descriptors in the kernel heap.
-    vma_area_t* curr = t->vma_list_head;
+    vma_area_t* curr = t->mm->vma_list_head;
     while (curr) {
         if (curr->vm_end == addr && curr->vm_flags == flags) {
             // Found a neighbor with identical flags!
-            uint64_t pages = size / 4096;
-            void* phys = pmm_alloc_frames(pages);
-            if (!phys) {
-                mutex_unlock(&t->vma_mutex);
-                return -1;
-            }
-
-            // Map the new physical frames into the existing virtual range
-            uint32_t vmm_opts = PTE_PRESENT | PTE_USER;
-            if (flags & VMA_WRITE) vmm_opts |= PTE_WRITABLE;
-            if (!(flags & VMA_EXEC)) vmm_opts |= PTE_NX;
-
-            vmm_map_range(vmm_get_table(t->cr3), addr, (uintptr_t)phys, size, vmm_opts);
-            memset((void*)phys_to_virt((uintptr_t)phys), 0, size);
-
             // Expand the boundary of the existing VMA
             curr->vm_end += size;
 
-            mutex_unlock(&t->vma_mutex);
+            mutex_unlock(&t->mm->vma_mutex);
             return 0; // Success via expansion, no new VMA descriptor created
         }
         curr = curr->next;
     }
 
     // 2. Overlap Check
-    vma_area_t* check = t->vma_list_head;
+    vma_area_t* check = t->mm->vma_list_head;
     while (check) {
         if (addr < check->vm_end && (addr + size) > check->vm_start) {
-            mutex_unlock(&t->vma_mutex);
+            mutex_unlock(&t->mm->vma_mutex);
             return -2;
         }
         check = check->next;
     }
 
     // 3. Allocate New VMA descriptor
-    vma_area_t* new_vma = kmalloc(sizeof(vma_area_t));
+    vma_area_t* new_vma = kmem_cache_alloc(vma_cache);
     if (!new_vma) {
-        mutex_unlock(&t->vma_mutex);
+        mutex_unlock(&t->mm->vma_mutex);
         return -3;
     }
-    memset(new_vma, 0, sizeof(vma_area_t));
 
     new_vma->vm_start = addr;
     new_vma->vm_end   = addr + size;
     new_vma->vm_flags = flags;
-    new_vma->color    = VMA_RED; // New nodes are always red
-
-    // 4. Physical memory allocation for the new region
-    uint64_t pages = size / 4096;
-    void* phys = pmm_alloc_frames(pages);
-    if (!phys) {
-        kfree(new_vma);
-        mutex_unlock(&t->vma_mutex);
-        return -4;
+
+    // 4. List + RB-Tree insertion
+    vma_insert(t, new_vma);
+
+    mutex_unlock(&t->mm->vma_mutex);
+    return 0;
+}
+
+/*
+ * Demand paging: resolves a page fault at 'addr' for task 't'.
+ * Looks the address up in the VMA tree, validates the access against the
+ * VMA permissions and maps a single zeroed frame, or breaks the sharing of
+ * a copy-on-write page on a write.
+ * Returns 0 if the fault was handled, -1 if it is a real access violation.
+ */
+int vma_handle_fault(struct task* t, uintptr_t addr, uint64_t error_code) {
+    if (!t || !t->mm) return -1;
+
+    // Present pages faulting here are protection violations, except CoW writes
+    if ((error_code & PF_ERR_PRESENT) && !(error_code & PF_ERR_WRITE)) return -1;
+
+    mutex_lock(&t->mm->vma_mutex);
+
+    vma_area_t* vma = vma_find(t, addr);
+    if (!vma ||
+        ((error_code & PF_ERR_WRITE) && !(vma->vm_flags & VMA_WRITE)) ||
+        ((error_code & PF_ERR_INSTR) && !(vma->vm_flags & VMA_EXEC)) ||
+        ((error_code & PF_ERR_USER)  && !(vma->vm_flags & VMA_USER))) {
+        mutex_unlock(&t->mm->vma_mutex);
+        return -1;
     }
 
-    // 5. Update Page Tables
-    uint32_t vmm_opts = PTE_PRESENT | PTE_USER;
-    if (flags & VMA_WRITE) vmm_opts |= PTE_WRITABLE;
-    if (!(flags & VMA_EXEC)) vmm_opts |= PTE_NX; 
-    
-    vmm_map_range(vmm_get_table(t->cr3), addr, (uintptr_t)phys, size, vmm_opts);
-    memset((void*)phys_to_virt((uintptr_t)phys), 0, size);
+    uintptr_t phys = (error_code & PF_ERR_PRESENT) ? vma_cow_page(t, vma, addr)
+                                                   : vma_populate_page(t, vma, addr);
 
-    // 6. Linked List Insertion (Keep it for easy iteration/destruction)
-    new_vma->next = t->vma_list_head;
-    if (t->vma_list_head) t->vma_list_head->prev = new_vma;
-    t->vma_list_head = new_vma;
+    mutex_unlock(&t->mm->vma_mutex);
+    return phys ? 0 : -1;
+}
 
-    // 7. RB-Tree Insertion
-    if (!t->vma_tree_root) {
-        t->vma_tree_root = new_vma;
-    } else {
-        vma_area_t* node = t->vma_tree_root;
-        while (1) {
-            if (new_vma->vm_start < node->vm_start) {
-                if (!node->left) { node->left = new_vma; new_vma->parent = node; break; }
-                node = node->left;
-            } else {
-                if (!node->right) { node->right = new_vma; new_vma->parent = node; break; }
-                node = node->right;
-            }
+/*
+ * Duplicates the address space of 'parent' into the fresh task 'child' for fork().
+ * VMA descriptors are copied and every populated page is shared copy-on-write,
+ * so no user memory is copied up front.
+ * Must be called by 'parent' itself. Returns 0 on success.
+ */
+int vma_fork(struct task* parent, struct task* child) {
+    int ret = 0;
+
+    mutex_lock(&parent->mm->vma_mutex);
+
+    page_table_t* src = vmm_get_table(parent->mm->cr3);
+    page_table_t* dst = vmm_get_table(child->mm->cr3);
+
+    for (vma_area_t* curr = parent->mm->vma_list_head; curr; curr = curr->next) {
+        vma_area_t* copy = kmem_cache_alloc(vma_cache);
+        if (!copy) {
+            ret = -3;
+            break;
+        }
+
+        copy->vm_start = curr->vm_start;
+        copy->vm_end   = curr->vm_end;
+        copy->vm_flags = curr->vm_flags;
+        vma_insert(child, copy);
+
+        if (!vmm_clone_range(src, dst, curr->vm_start, curr->vm_end)) {
+            ret = -3;
+            break;
         }
     }
 
-    // 8. Rebalance the Tree
-    vma_insert_fixup(t, new_vma);
+    mutex_unlock(&parent->mm->vma_mutex);
+    return ret;
+}
 
-    t->vma_count++;
-    mutex_unlock(&t->vma_mutex);
-    return 0;
+/*
+ * Returns the physical address backing 'addr', populating the page first
+ * if it was never touched. Used by the kernel to fill user memory
+ * (e.g. the ELF loader) without going through a page fault.
+ */
+uintptr_t vma_get_page(struct task* t, uintptr_t addr) {
+    mutex_lock(&t->mm->vma_mutex);
+
+    vma_area_t* vma = vma_find(t, addr);
+    uintptr_t phys = vma ? vma_populate_page(t, vma, addr) : 0;
+
+    mutex_unlock(&t->mm->vma_mutex);
+    return phys ? phys + (addr & 0xFFF) : 0;
 }
 
 /*
@@ -243,28 +425,28 @@ int vma_map(struct task* t, uintptr_t addr, size_t size, uint32_t flags) {
 int vma_unmap(struct task* t, uintptr_t addr, size_t size) {
     if (size == 0) return 0;
 
-    mutex_lock(&t->vma_mutex);
+    mutex_lock(&t->mm->vma_mutex);
 
     // 1. Locate the VMA area containing the start address
     vma_area_t* vma = vma_find(t, addr);
     if (!vma) {
-        mutex_unlock(&t->vma_mutex);
+        mutex_unlock(&t->mm->vma_mutex);
         return -1;
     }
 
     uintptr_t unmap_end = addr + size;
-    page_table_t* pml4 = vmm_get_table(t->cr3);
+    page_table_t* pml4 = vmm_get_table(t->mm->cr3);
 
     // 2. Iterate through the requested range and release resources page-by-page
-    // We only unmap the 'size' requested, not necessarily the whole VMA
+    // We only unmap the 'size' requested, not necessarily the whole VMA.
+    // Pages that were never touched have no frame and are skipped.
+    // All pages share one TLB shootdown, frames are released after it.
+    tlb_batch_t batch;
+    tlb_batch_init(&batch, t->mm->cr3);
+
     for (uintptr_t vaddr = addr; vaddr < unmap_end; vaddr += PAGE_SIZE) {
-        uintptr_t phys = vmm_virtual_to_physical(pml4, vaddr);
-        if (phys) {
-            // Remove entry from Page Tables (VMM)
-            vmm_unmap(pml4, vaddr);
-            // Return the physical frame to the PMM allocator
-            pmm_free_frame((void*)phys);
-        }
+        uintptr_t phys = vmm_unmap_page(pml4, vaddr);
+        if (phys) tlb_batch_add(&batch, vaddr, phys);
     }
 
     // 3. CASE A: Partial Unmap (Trimming the tail of the VMA)
@@ -279,8 +461,8 @@ int vma_unmap(struct task* t, uintptr_t addr, size_t size) {
         // Remove from the doubly-linked list
         if (vma->prev) vma->prev->next = vma->next;
         if (vma->next) vma->next->prev = vma->prev;
-        if (t->vma_list_head == vma) {
-            t->vma_list_head = vma->next;
+        if (t->mm->vma_list_head == vma) {
+            t->mm->vma_list_head = vma->next;
         }
 
         // Remove from the BST
@@ -298,7 +480,7 @@ int vma_unmap(struct task* t, uintptr_t addr, size_t size) {
         }
 
         if (!vma->parent) {
-            t->vma_tree_root = replacement;
+            t->mm->vma_tree_root = replacement;
         } else {
             if (vma->parent->left == vma) vma->parent->left = replacement;
             else vma->parent->right = replacement;
@@ -306,41 +488,29 @@ int vma_unmap(struct task* t, uintptr_t addr, size_t size) {
         
         if (replacement) replacement->parent = vma->parent;
 
-        t->vma_count--;
+        t->mm->vma_count--;
         
         // Free the VMA descriptor from the Kernel Heap
-        kfree(vma);
+        kmem_cache_free(vma_cache, vma);
     } 
 finalize:
-    // 5. Invalidate TLB to ensure no CPU uses stale mappings
-    sync_tlb();
-    mutex_unlock(&t->vma_mutex); 
+    // 5. Invalidate TLBs of the CPUs that ran this task, then free the frames
+    tlb_batch_flush(&batch);
+    mutex_unlock(&t->mm->vma_mutex); 
 
     return 0;
 }
 
 /*
- * Iterates through the VMA list and releases EVERYTHING.
- * Crucial for the Reaper/task_exit to prevent memory leaks.
+ * Detaches 't' from its address space. The memory itself is released with
+ * the last task using it (see mm_put), so a thread exiting leaves its
+ * siblings untouched. Called by the Reaper and on failed task creation.
  */
 void vma_destroy_all(struct task* t) {
-    mutex_lock(&t->vma_mutex);
-
-    vma_area_t* curr = t->vma_list_head;
+    mm_t* mm = t->mm;
+    if (!mm) return;
 
-    while (curr) {
-        vma_area_t* next = curr->next;
-        kfree(curr);
-        curr = next;
-    }
-
-    t->vma_list_head = NULL;
-    t->vma_tree_root = NULL;
-    t->vma_count = 0;
-
-    if (t->cr3 != 0) {
-        vmm_destroy_user_pml4(t->cr3, true);
-        t->cr3 = 0;
-    }
-    mutex_unlock(&t->vma_mutex);
+    t->mm  = NULL;
+    t->cr3 = 0;
+    mm_put(mm);
 }
@@ -1,5 +1,6 @@
 #include <vmm.h>
 #include <pmm.h>
+#include <tlb.h>
 #include <cpu.h>
 #include <panic.h>
 #include <atomic.h>
@@ -7,7 +8,8 @@
 #include <efi_descriptor.h>
 
 /* Default ADDR MASK and default HHDM OFFSET */
-#define VMM_ADDR_MASK 0x000000FFFFFFF000ULL
+#define VMM_2M_MASK   0x000000FFFFE00000ULL
+#define VMM_1G_MASK   0x000000FFC0000000ULL
 #define HHDM_OFFSET 0xFFFF800000000000
 
 static spinlock_t vmm_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };
@@ -15,6 +17,11 @@ static spinlock_t vmm_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };
 page_table_t* kernel_pml4 = NULL;
 static uintptr_t kernel_pml4_phys = 0;
 
+/* Physical address of a table pointer (tables are reached through the HHDM once paging is ours) */
+static inline uintptr_t vmm_table_phys(page_table_t* table) {
+    return kernel_pml4 ? (uintptr_t)table - HHDM_OFFSET : (uintptr_t)table;
+}
+
 /* Symbols from the linker script */
 extern uint8_t _kernel_start[];
 extern uint8_t _kernel_end[];
@@ -43,6 +50,66 @@ void vmm_enable_pat() {
     __asm__ volatile("wrmsr" : : "a"(low), "d"(high), "c"(0x277));
 }
 
+/*
+ * Enables Process-Context Identifiers on the current CPU when supported
+ * (CPUID.01H:ECX bit 17). Must run while CR3 still carries PCID 0.
+ */
+void vmm_enable_pcid() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1 << 17))) return;
+
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PCIDE;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    get_cpu()->pcid_enabled = true;
+}
+
+/*
+ * Loads the address space 'cr3' on the current CPU. Called by the scheduler with IRQs off.
+ * With PCID every CPU keeps the last CPU_PCID_SLOTS address spaces tagged in its TLB:
+ * switching back to one of them sets CR3_NOFLUSH, a miss recycles the next slot
+ * round-robin and flushes its PCID. Slots retired by tlb_shootdown() are dropped first.
+ */
+void vmm_switch_address_space(uintptr_t cr3) {
+    cpu_context_t* cpu = get_cpu();
+    cr3 &= VMM_ADDR_MASK;
+
+    if (cr3 == cpu->active_cr3) return;
+
+    // Publish before reading the stale mask: a concurrent shootdown
+    // either sees us in 'cr3' and sends an IPI, or its mark is seen below
+    __atomic_store_n(&cpu->active_cr3, cr3, __ATOMIC_SEQ_CST);
+
+    if (!cpu->pcid_enabled) {
+        write_cr3(cr3);
+        return;
+    }
+
+    uint32_t stale = __atomic_exchange_n(&cpu->pcid_stale, 0, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < CPU_PCID_SLOTS; i++) {
+        if (stale & (1U << i)) cpu->pcid_cr3[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < CPU_PCID_SLOTS; i++) {
+        if (cpu->pcid_cr3[i] == cr3) {
+            write_cr3(cr3 | (i + 1) | CR3_NOFLUSH);
+            return;
+        }
+    }
+
+    // Miss: recycle a slot, keeping the outgoing address space warm
+    uint32_t active_pcid = read_cr3() & CR3_PCID_MASK;
+    uint32_t slot = cpu->pcid_next;
+    if (slot + 1 == active_pcid) slot = (slot + 1) % CPU_PCID_SLOTS;
+    cpu->pcid_next = (slot + 1) % CPU_PCID_SLOTS;
+
+    cpu->pcid_cr3[slot] = cr3;
+    write_cr3(cr3 | (slot + 1));
+}
+
 uintptr_t vmm_create_user_pml4() {
     uintptr_t pml4_phys = (uintptr_t)pmm_alloc_frame();
     if (!pml4_phys) return 0;
@@ -63,6 +130,10 @@ uintptr_t vmm_create_user_pml4() {
 void vmm_destroy_user_pml4(uintptr_t cr3, bool free_frames) {
     page_table_t* pml4 = (page_table_t*)phys_to_virt(cr3);
 
+    // Nobody runs this address space anymore, retire its cached PCIDs
+    // before the frames (and the PML4 itself) can be reused
+    tlb_shootdown(cr3, 0, TLB_KERNEL_HALF);
+
     // We only iterate through the lower half (user space, first 256 entries)
     for (int i = 0; i < 256; i++) {
         if (!(pml4->entries[i] & PTE_PRESENT)) continue;
@@ -90,11 +161,12 @@ void vmm_destroy_user_pml4(uintptr_t cr3, bool free_frames) {
 
                 page_table_t* pt = (page_table_t*)phys_to_virt(pd->entries[k] & VMM_ADDR_MASK);
 
-                // Free the actual physical data frames if requested
+                // Release the actual physical data frames if requested
+                // (frames shared copy-on-write only lose one owner)
                 if (free_frames) {
                     for (int l = 0; l < 512; l++) {
                         if (pt->entries[l] & PTE_PRESENT) {
-                            pmm_free_frame((void*)(pt->entries[l] & VMM_ADDR_MASK));
+                            pmm_frame_put(pt->entries[l] & VMM_ADDR_MASK);
                         }
                     }
                 }
@@ -109,12 +181,64 @@ void vmm_destroy_user_pml4(uintptr_t cr3, bool free_frames) {
     }
     // Finally, free the PML4 frame
     pmm_free_frame((void*)cr3);
-    sync_tlb(); // Flush TLB
 }
 
 /*
  * UNLOCKED SECTION
  */
+
+/*
+ * Returns the 4KB leaf entry for 'virt' without allocating anything,
+ * or NULL if a level is missing or the address is covered by a huge page.
+ */
+static pt_entry* _vmm_get_pte_unlocked(page_table_t* pml4, uintptr_t virt) {
+    if (!(pml4->entries[PML4_IDX(virt)] & PTE_PRESENT)) return NULL;
+    page_table_t* pdpt = vmm_get_table(pml4->entries[PML4_IDX(virt)] & VMM_ADDR_MASK);
+
+    pt_entry pdpte = pdpt->entries[PDPT_IDX(virt)];
+    if (!(pdpte & PTE_PRESENT) || (pdpte & PTE_HUGE)) return NULL;
+    page_table_t* pd = vmm_get_table(pdpte & VMM_ADDR_MASK);
+
+    pt_entry pde = pd->entries[PD_IDX(virt)];
+    if (!(pde & PTE_PRESENT) || (pde & PTE_HUGE)) return NULL;
+    page_table_t* pt = vmm_get_table(pde & VMM_ADDR_MASK);
+
+    return &pt->entries[PT_IDX(virt)];
+}
+
+
+/*
+ * Replaces a huge entry with a freshly allocated table that maps the same range
+ * with the same attributes one level lower, so a part of it can be changed.
+ * level 1 = PDPT entry (1GB -> 512 x 2MB), level 2 = PD entry (2MB -> 512 x 4KB).
+ */
+static bool _vmm_split_huge_unlocked(pt_entry* entry, int level) {
+    uintptr_t table_phys = (uintptr_t)pmm_alloc_frame();
+    if (!table_phys) return false;
+    page_table_t* table = vmm_get_table(table_phys);
+
+    uint64_t e = *entry;
+    uint64_t attrs = e & (0xFFFULL | PTE_PAT_HUGE | PTE_NX);
+
+    if (level == 1) {
+        uintptr_t base = e & VMM_1G_MASK;
+        for (int i = 0; i < 512; i++) {
+            table->entries[i] = (base + i * PAGE_SIZE_2M) | attrs;
+        }
+    } else {
+        uintptr_t base = e & VMM_2M_MASK;
+        // 4KB entries keep PAT in bit 7, where huge entries keep the PS bit
+        attrs &= ~(PTE_HUGE | PTE_PAT_HUGE);
+        if (e & PTE_PAT_HUGE) attrs |= (1ULL << 7);
+        for (int i = 0; i < 512; i++) {
+            table->entries[i] = (base + i * PAGE_SIZE) | attrs;
+        }
+    }
+
+    *entry = (table_phys & VMM_ADDR_MASK) | PTE_PRESENT | PTE_WRITABLE | (e & PTE_USER);
+    return true;
+}
+
 static void _vmm_unmap_unlocked(page_table_t* pml4, uintptr_t virt) {
     uint64_t pml4_i = PML4_IDX(virt);
     uint64_t pdpt_i = PDPT_IDX(virt);
@@ -125,9 +249,11 @@ static void _vmm_unmap_unlocked(page_table_t* pml4, uintptr_t virt) {
     page_table_t* pdpt = vmm_get_table(pml4->entries[pml4_i] & VMM_ADDR_MASK);
 
     if (!(pdpt->entries[pdpt_i] & PTE_PRESENT)) return;
+    if ((pdpt->entries[pdpt_i] & PTE_HUGE) && !_vmm_split_huge_unlocked(&pdpt->entries[pdpt_i], 1)) return;
     page_table_t* pd = vmm_get_table(pdpt->entries[pdpt_i] & VMM_ADDR_MASK);
 
     if (!(pd->entries[pd_i] & PTE_PRESENT)) return;
+    if ((pd->entries[pd_i] & PTE_HUGE) && !_vmm_split_huge_unlocked(&pd->entries[pd_i], 2)) return;
     page_table_t* pt = vmm_get_table(pd->entries[pd_i] & VMM_ADDR_MASK);
 
     pt->entries[pt_i] = 0;
@@ -164,6 +290,10 @@ static bool _vmm_map_unlocked(page_table_t* pml4, uintptr_t virt, uintptr_t phys
             current_table->entries[indices[level]] = (new_table_phys & VMM_ADDR_MASK) 
                                                      | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
         } else {
+            // A 4KB page inside a 2MB/1GB mapping: break the huge page up first
+            if (level > 0 && (entry & PTE_HUGE)) {
+                if (!_vmm_split_huge_unlocked(&current_table->entries[indices[level]], level)) return false;
+            }
             if (flags & PTE_USER) current_table->entries[indices[level]] |= PTE_USER;
             if (flags & PTE_WRITABLE) current_table->entries[indices[level]] |= PTE_WRITABLE;
         }
@@ -191,6 +321,88 @@ static bool _vmm_map_range_unlocked(page_table_t* pml4, uintptr_t virt, uintptr_
     return true;
 }
 
+/*
+ * Maps a single 1GB (level 1, PDPT) or 2MB (level 2, PD) page.
+ * Returns false if the slot is already used by a lower-level table,
+ * the caller then falls back to smaller pages.
+ */
+static bool _vmm_map_huge_unlocked(page_table_t* pml4, uintptr_t virt, uintptr_t phys, uint64_t flags, int level) {
+    uint64_t indices[3] = {
+        PML4_IDX(virt),
+        PDPT_IDX(virt),
+        PD_IDX(virt)
+    };
+
+    page_table_t* current_table = pml4;
+
+    for (int l = 0; l < level; l++) {
+        uint64_t entry = current_table->entries[indices[l]];
+
+        if (!(entry & PTE_PRESENT)) {
+            uintptr_t new_table_phys = (uintptr_t)pmm_alloc_frame();
+            if (!new_table_phys) return false;
+
+            memset(vmm_get_table(new_table_phys), 0, PAGE_SIZE);
+            current_table->entries[indices[l]] = (new_table_phys & VMM_ADDR_MASK)
+                                                 | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+        } else if (l > 0 && (entry & PTE_HUGE)) {
+            if (!_vmm_split_huge_unlocked(&current_table->entries[indices[l]], l)) return false;
+        }
+
+        current_table = vmm_get_table(current_table->entries[indices[l]] & VMM_ADDR_MASK);
+    }
+
+    uint64_t entry = current_table->entries[indices[level]];
+    if ((entry & PTE_PRESENT) && !(entry & PTE_HUGE)) return false;
+
+    uint64_t mask = (level == 1) ? VMM_1G_MASK : VMM_2M_MASK;
+    current_table->entries[indices[level]] = (phys & mask) | flags | PTE_PRESENT | PTE_HUGE;
+    vmm_invlpg((void*)virt);
+
+    return true;
+}
+
+/*
+ * Builds the Higher Half Direct Map for [phys, end) with the largest pages
+ * that fit: 1GB where supported and aligned, then 2MB, and 4KB only at
+ * unaligned edges. HHDM_OFFSET is 1GB aligned, so alignment of the physical
+ * address is also alignment of the virtual one.
+ */
+static void _vmm_map_hhdm_unlocked(page_table_t* pml4, uintptr_t phys, uintptr_t end, bool use_1g) {
+    const uint64_t flags = PTE_PRESENT | PTE_WRITABLE;
+
+    while (phys < end) {
+        uintptr_t virt = phys + HHDM_OFFSET;
+
+        if (use_1g && !(phys & (PAGE_SIZE_1G - 1)) && end - phys >= PAGE_SIZE_1G &&
+            _vmm_map_huge_unlocked(pml4, virt, phys, flags, 1)) {
+            phys += PAGE_SIZE_1G;
+            continue;
+        }
+
+        if (!(phys & (PAGE_SIZE_2M - 1)) && end - phys >= PAGE_SIZE_2M &&
+            _vmm_map_huge_unlocked(pml4, virt, phys, flags, 2)) {
+            phys += PAGE_SIZE_2M;
+            continue;
+        }
+
+        _vmm_map_unlocked(pml4, virt, phys, flags);
+        phys += PAGE_SIZE;
+    }
+}
+
+/*
+ * CPUID.80000001h:EDX[26] (Page1GB)
+ */
+static bool vmm_cpu_has_1g_pages() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000001) return false;
+
+    cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & (1U << 26)) != 0;
+}
+
 /*
  * Maps a virtual page to a physical frame.
  * If intermediate tables don't exist, they are allocated using PMM.
@@ -199,11 +411,17 @@ void vmm_map(page_table_t* pml4, uintptr_t virt, uintptr_t phys, uint64_t flags)
     uint64_t f = spin_irq_save();
     spin_lock(&vmm_lock_);
 
+    // Replacing a live translation (e.g. breaking copy-on-write) needs a shootdown
+    pt_entry* old = _vmm_get_pte_unlocked(pml4, virt);
+    bool live = old && (*old & PTE_PRESENT);
+
     bool success = _vmm_map_unlocked(pml4, virt, phys, flags);
 
     spin_unlock(&vmm_lock_);
     spin_irq_restore(f);
 
+    if (live) tlb_shootdown(vmm_table_phys(pml4), virt, virt + PAGE_SIZE);
+
     if (!success) {
         if (virt >= HHDM_OFFSET) {
             panic("VMM: Critical kernel mapping failed! (Out of memory for page tables)");
@@ -234,33 +452,13 @@ void vmm_map_range(page_table_t* pml4, uintptr_t virt, uintptr_t phys, size_t si
 }
 
 /*
- * !!! HUGE PAGES FOR NOW UNUSED !!!
+ * Maps a single 2MB page. Both addresses must be 2MB aligned.
  */
 void vmm_map_huge(page_table_t* pml4, uintptr_t virt, uintptr_t phys, uint64_t flags) {
     uint64_t f = spin_irq_save();
     spin_lock(&vmm_lock_);
 
-    uint64_t pml4_i = PML4_IDX(virt);
-    uint64_t pdpt_i = PDPT_IDX(virt);
-    uint64_t pd_i   = PD_IDX(virt);
-
-    if (!(pml4->entries[pml4_i] & PTE_PRESENT)) {
-        uintptr_t new_table = (uintptr_t)pmm_alloc_frame();
-        memset(vmm_get_table(new_table), 0, PAGE_SIZE);
-        pml4->entries[pml4_i] = (new_table & VMM_ADDR_MASK) | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-    }
-    page_table_t* pdpt = vmm_get_table(pml4->entries[pml4_i] & VMM_ADDR_MASK);
-
-    if (!(pdpt->entries[pdpt_i] & PTE_PRESENT)) {
-        uintptr_t new_table = (uintptr_t)pmm_alloc_frame();
-        memset(vmm_get_table(new_table), 0, PAGE_SIZE);
-        pdpt->entries[pdpt_i] = (new_table & VMM_ADDR_MASK) | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-    }
-    page_table_t* pd = vmm_get_table(pdpt->entries[pdpt_i] & VMM_ADDR_MASK);
-
-    pd->entries[pd_i] = (phys & VMM_ADDR_MASK) | flags | 0x81; // 0x81 = Present + Huge Page
-
-    vmm_invlpg((void*)virt);  // Local flush
+    _vmm_map_huge_unlocked(pml4, virt, phys, flags, 2);
 
     spin_unlock(&vmm_lock_);
     spin_irq_restore(f);
@@ -291,39 +489,48 @@ void vmm_unmap(page_table_t* pml4, uintptr_t virt) {
     uint64_t f = spin_irq_save();
     spin_lock(&vmm_lock_);
 
-    uint64_t pml4_i = PML4_IDX(virt);
-    uint64_t pdpt_i = PDPT_IDX(virt);
-    uint64_t pd_i   = PD_IDX(virt);
-    uint64_t pt_i   = PT_IDX(virt);
+    _vmm_unmap_unlocked(pml4, virt);
 
-    if (!(pml4->entries[pml4_i] & PTE_PRESENT)) goto done;
-    page_table_t* pdpt = vmm_get_table(pml4->entries[pml4_i] & VMM_ADDR_MASK);
+    spin_unlock(&vmm_lock_);
+    spin_irq_restore(f);
 
-    if (!(pdpt->entries[pdpt_i] & PTE_PRESENT)) goto done;
-    page_table_t* pd = vmm_get_table(pdpt->entries[pdpt_i] & VMM_ADDR_MASK);
+    tlb_shootdown(vmm_table_phys(pml4), virt, virt + PAGE_SIZE);
+}
 
-    if (!(pd->entries[pd_i] & PTE_PRESENT)) goto done;
-    page_table_t* pt = vmm_get_table(pd->entries[pd_i] & VMM_ADDR_MASK);
+void vmm_unmap_range(page_table_t* pml4, uintptr_t virt, size_t size) {
+    uint64_t f = spin_irq_save();
+    spin_lock(&vmm_lock_);
 
-    pt->entries[pt_i] = 0;
-    vmm_invlpg((void*)virt);
+    _vmm_unmap_range_unlocked(pml4, virt, size);
 
-done:
-    sync_tlb(); // Flush TLB
     spin_unlock(&vmm_lock_);
     spin_irq_restore(f);
+
+    tlb_shootdown(vmm_table_phys(pml4), virt, virt + size);
 }
 
-void vmm_unmap_range(page_table_t* pml4, uintptr_t virt, size_t size) {
+/*
+ * Clears the 4KB mapping of 'virt' and returns the frame it pointed to (0 if none).
+ * Only the local TLB entry is dropped: the caller queues the page in a
+ * tlb_batch_t and releases the frame once the batch is flushed.
+ */
+uintptr_t vmm_unmap_page(page_table_t* pml4, uintptr_t virt) {
+    uintptr_t phys = 0;
+
     uint64_t f = spin_irq_save();
     spin_lock(&vmm_lock_);
 
-    _vmm_unmap_range_unlocked(pml4, virt, size);
-
-    sync_tlb();  // Flush TLB
+    pt_entry* pte = _vmm_get_pte_unlocked(pml4, virt);
+    if (pte && (*pte & PTE_PRESENT)) {
+        phys = *pte & VMM_ADDR_MASK;
+        *pte = 0;
+        vmm_invlpg((void*)virt);
+    }
 
     spin_unlock(&vmm_lock_);
     spin_irq_restore(f);
+
+    return phys;
 }
 
 /*
@@ -334,22 +541,85 @@ uintptr_t vmm_virtual_to_physical(page_table_t* pml4, uintptr_t virt) {
     if (!(pml4->entries[PML4_IDX(virt)] & PTE_PRESENT)) return 0;
     page_table_t* pdpt = vmm_get_table(pml4->entries[PML4_IDX(virt)] & VMM_ADDR_MASK);
 
-    if (!(pdpt->entries[PDPT_IDX(virt)] & PTE_PRESENT)) return 0;
-    page_table_t* pd = vmm_get_table(pdpt->entries[PDPT_IDX(virt)] & VMM_ADDR_MASK);
+    pt_entry pdpte = pdpt->entries[PDPT_IDX(virt)];
+    if (!(pdpte & PTE_PRESENT)) return 0;
 
-    // Check Huge Page (2MB)
-    if (pd->entries[PD_IDX(virt)] & (1 << 7)) {
-        return (pd->entries[PD_IDX(virt)] & 0xFFFFFFFFFE000000ULL) + (virt & 0x1FFFFF);
+    // Check Huge Page (1GB)
+    if (pdpte & PTE_HUGE) {
+        return (pdpte & VMM_1G_MASK) + (virt & (PAGE_SIZE_1G - 1));
     }
+    page_table_t* pd = vmm_get_table(pdpte & VMM_ADDR_MASK);
 
-    if (!(pd->entries[PD_IDX(virt)] & PTE_PRESENT)) return 0;
-    page_table_t* pt = vmm_get_table(pd->entries[PD_IDX(virt)] & VMM_ADDR_MASK);
+    pt_entry pde = pd->entries[PD_IDX(virt)];
+    if (!(pde & PTE_PRESENT)) return 0;
+
+    // Check Huge Page (2MB)
+    if (pde & PTE_HUGE) {
+        return (pde & VMM_2M_MASK) + (virt & (PAGE_SIZE_2M - 1));
+    }
+    page_table_t* pt = vmm_get_table(pde & VMM_ADDR_MASK);
 
     if (!(pt->entries[PT_IDX(virt)] & PTE_PRESENT)) return 0;
 
     return (pt->entries[PT_IDX(virt)] & VMM_ADDR_MASK) + (virt & 0xFFF);
 }
 
+pt_entry vmm_get_entry(page_table_t* pml4, uintptr_t virt) {
+    pt_entry* pte = _vmm_get_pte_unlocked(pml4, virt);
+    return pte ? *pte : 0;
+}
+
+/*
+ * Copy-on-write duplication of the user range [start, end) from 'src' into 'dst'.
+ * Every present page is mapped into 'dst' with the same frame, which gains an
+ * owner in the PMM. Writable pages lose PTE_WRITABLE on both sides and get
+ * PTE_COW, so the first write from either side faults and copies the frame.
+ * Must be called from the task owning 'src' (its stale TLB entries are
+ * invalidated locally by the mapping helper).
+ */
+bool vmm_clone_range(page_table_t* src, page_table_t* dst, uintptr_t start, uintptr_t end) {
+    bool ok = true;
+    bool downgraded = false;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&vmm_lock_);
+
+    uintptr_t virt = start;
+    while (virt < end) {
+        pt_entry* pte = _vmm_get_pte_unlocked(src, virt);
+        if (!pte) {
+            // No page table here, skip to the next 2MB boundary
+            virt = (virt + PAGE_SIZE_2M) & ~(PAGE_SIZE_2M - 1);
+            continue;
+        }
+
+        if (*pte & PTE_PRESENT) {
+            if (*pte & PTE_WRITABLE) {
+                *pte = (*pte & ~PTE_WRITABLE) | PTE_COW;
+                downgraded = true;
+            }
+
+            uintptr_t phys = *pte & VMM_ADDR_MASK;
+            uint64_t flags = *pte & ~(VMM_ADDR_MASK | PTE_ACCESSED | PTE_DIRTY);
+
+            if (!_vmm_map_unlocked(dst, virt, phys, flags)) {
+                ok = false;
+                break;
+            }
+            pmm_frame_get(phys);
+        }
+        virt += PAGE_SIZE;
+    }
+
+    spin_unlock(&vmm_lock_);
+    spin_irq_restore(f);
+
+    // The parent may still be cached writable under an idle PCID of another CPU
+    if (downgraded) tlb_shootdown(vmm_table_phys(src), start, end);
+
+    return ok;
+}
+
 /*
  * Transform PA -> VA, by adding HHDM offset
  */
@@ -377,9 +647,14 @@ void vmm_init(BootInfo* bi) {
     }
 
     // 2.  DIRECT PHYSICAL MAPPING (HHDM)
+    // Contiguous descriptors are merged into one run and mapped with 1GB/2MB pages,
+    // which saves page-table frames and keeps phys_to_virt() accesses TLB friendly.
     uint64_t desc_size = bi->mmap.descriptor_size;
     uint64_t total_map_size = bi->mmap.memory_map_size;
     uint8_t* map_ptr = (uint8_t*)bi->mmap.memory_map;
+    bool use_1g = vmm_cpu_has_1g_pages();
+
+    uintptr_t run_start = 0, run_end = 0;
 
     for (uint64_t offset = 0; offset < total_map_size; offset += desc_size) {
         EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)(map_ptr + offset);
@@ -388,13 +663,14 @@ void vmm_init(BootInfo* bi) {
             uint64_t phys_start = desc->physical_start;
             uint64_t size = desc->num_pages * 4096;
 
-            _vmm_map_range_unlocked(local_pml4, 
-                                    phys_start + HHDM_OFFSET, 
-                                    phys_start, 
-                                    size, 
-                                    PTE_PRESENT | PTE_WRITABLE);
+            if (phys_start != run_end) {
+                if (run_end > run_start) _vmm_map_hhdm_unlocked(local_pml4, run_start, run_end, use_1g);
+                run_start = phys_start;
+            }
+            run_end = phys_start + size;
         }
     }
+    if (run_end > run_start) _vmm_map_hhdm_unlocked(local_pml4, run_start, run_end, use_1g);
 
     // 3. HIGHER HALF KERNEL MAPPING
     uintptr_t text_phys = KERNEL_PHYS_BASE + ((uintptr_t)_text_start - KERNEL_VIRT_BASE);
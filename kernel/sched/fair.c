@@ -0,0 +1,400 @@
+#include <fair.h>
+#include <sched.h>
+#include <cpu.h>
+
+/* nice -20..19 -> weight, same geometric table as Linux CFS */
+static const uint32_t fair_nice_weights[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */  9548,  7620,  6100,  4904,  3906,
+    /*  -5 */  3121,  2501,  1991,  1586,  1277,
+    /*   0 */  1024,   820,   655,   526,   423,
+    /*   5 */   335,   272,   215,   172,   137,
+    /*  10 */   110,    87,    70,    56,    45,
+    /*  15 */    36,    29,    23,    18,    15,
+};
+
+/* vruntime ordering that survives wrap-around */
+static inline bool vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static inline bool fair_is_red(task_t* t) {
+    return t && t->fair.red;
+}
+
+/*
+ *  UNLOCKED SECTION (callers hold cpu->rq_lock)
+ */
+
+/* Red/Black helpers, same shape as the VMA tree's */
+static void fair_rotate_left(cpu_context_t* cpu, task_t* x) {
+    task_t* y = x->fair.right;
+    x->fair.right = y->fair.left;
+
+    if (y->fair.left) y->fair.left->fair.parent = x;
+    y->fair.parent = x->fair.parent;
+
+    if (!x->fair.parent) cpu->fair_root = y;
+    else if (x == x->fair.parent->fair.left) x->fair.parent->fair.left = y;
+    else x->fair.parent->fair.right = y;
+
+    y->fair.left = x;
+    x->fair.parent = y;
+}
+
+static void fair_rotate_right(cpu_context_t* cpu, task_t* y) {
+    task_t* x = y->fair.left;
+    y->fair.left = x->fair.right;
+
+    if (x->fair.right) x->fair.right->fair.parent = y;
+    x->fair.parent = y->fair.parent;
+
+    if (!y->fair.parent) cpu->fair_root = x;
+    else if (y == y->fair.parent->fair.right) y->fair.parent->fair.right = x;
+    else y->fair.parent->fair.left = x;
+
+    x->fair.right = y;
+    y->fair.parent = x;
+}
+
+static void fair_insert_fixup(cpu_context_t* cpu, task_t* z) {
+    while (fair_is_red(z->fair.parent)) {
+        task_t* parent = z->fair.parent;
+        task_t* grand  = parent->fair.parent;
+
+        if (parent == grand->fair.left) {
+            task_t* y = grand->fair.right;
+
+            if (fair_is_red(y)) {
+                parent->fair.red = false;
+                y->fair.red = false;
+                grand->fair.red = true;
+                z = grand;
+            } else {
+                if (z == parent->fair.right) {
+                    z = parent;
+                    fair_rotate_left(cpu, z);
+                }
+                z->fair.parent->fair.red = false;
+                z->fair.parent->fair.parent->fair.red = true;
+                fair_rotate_right(cpu, z->fair.parent->fair.parent);
+            }
+        } else {
+            // Right side
+            task_t* y = grand->fair.left;
+
+            if (fair_is_red(y)) {
+                parent->fair.red = false;
+                y->fair.red = false;
+                grand->fair.red = true;
+                z = grand;
+            } else {
+                if (z == parent->fair.left) {
+                    z = parent;
+                    fair_rotate_right(cpu, z);
+                }
+                z->fair.parent->fair.red = false;
+                z->fair.parent->fair.parent->fair.red = true;
+                fair_rotate_left(cpu, z->fair.parent->fair.parent);
+            }
+        }
+    }
+    cpu->fair_root->fair.red = false;
+}
+
+/* Puts 'v' (may be NULL) where 'u' hangs in the tree */
+static void fair_transplant(cpu_context_t* cpu, task_t* u, task_t* v) {
+    if (!u->fair.parent) cpu->fair_root = v;
+    else if (u == u->fair.parent->fair.left) u->fair.parent->fair.left = v;
+    else u->fair.parent->fair.right = v;
+
+    if (v) v->fair.parent = u->fair.parent;
+}
+
+/*
+ * Restores the black height after a black node was unlinked. 'x' took its
+ * place and may be NULL, so its parent is passed separately.
+ */
+static void fair_erase_fixup(cpu_context_t* cpu, task_t* x, task_t* parent) {
+    while (x != cpu->fair_root && !fair_is_red(x)) {
+        if (x == parent->fair.left) {
+            task_t* w = parent->fair.right;
+
+            if (fair_is_red(w)) {
+                w->fair.red = false;
+                parent->fair.red = true;
+                fair_rotate_left(cpu, parent);
+                w = parent->fair.right;
+            }
+
+            if (!fair_is_red(w->fair.left) && !fair_is_red(w->fair.right)) {
+                w->fair.red = true;
+                x = parent;
+                parent = x->fair.parent;
+            } else {
+                if (!fair_is_red(w->fair.right)) {
+                    w->fair.left->fair.red = false;
+                    w->fair.red = true;
+                    fair_rotate_right(cpu, w);
+                    w = parent->fair.right;
+                }
+                w->fair.red = parent->fair.red;
+                parent->fair.red = false;
+                if (w->fair.right) w->fair.right->fair.red = false;
+                fair_rotate_left(cpu, parent);
+                x = cpu->fair_root;
+            }
+        } else {
+            // Right side
+            task_t* w = parent->fair.left;
+
+            if (fair_is_red(w)) {
+                w->fair.red = false;
+                parent->fair.red = true;
+                fair_rotate_right(cpu, parent);
+                w = parent->fair.left;
+            }
+
+            if (!fair_is_red(w->fair.left) && !fair_is_red(w->fair.right)) {
+                w->fair.red = true;
+                x = parent;
+                parent = x->fair.parent;
+            } else {
+                if (!fair_is_red(w->fair.left)) {
+                    w->fair.right->fair.red = false;
+                    w->fair.red = true;
+                    fair_rotate_left(cpu, w);
+                    w = parent->fair.left;
+                }
+                w->fair.red = parent->fair.red;
+                parent->fair.red = false;
+                if (w->fair.left) w->fair.left->fair.red = false;
+                fair_rotate_right(cpu, parent);
+                x = cpu->fair_root;
+            }
+        }
+    }
+    if (x) x->fair.red = false;
+}
+
+static void fair_erase(cpu_context_t* cpu, task_t* z) {
+    task_t* y = z;
+    bool y_red = y->fair.red;
+    task_t* x;
+    task_t* x_parent;
+
+    if (!z->fair.left) {
+        x = z->fair.right;
+        x_parent = z->fair.parent;
+        fair_transplant(cpu, z, z->fair.right);
+    } else if (!z->fair.right) {
+        x = z->fair.left;
+        x_parent = z->fair.parent;
+        fair_transplant(cpu, z, z->fair.left);
+    } else {
+        // Two children: the successor takes z's place and color
+        y = z->fair.right;
+        while (y->fair.left) y = y->fair.left;
+        y_red = y->fair.red;
+        x = y->fair.right;
+
+        if (y->fair.parent == z) {
+            x_parent = y;
+        } else {
+            x_parent = y->fair.parent;
+            fair_transplant(cpu, y, y->fair.right);
+            y->fair.right = z->fair.right;
+            y->fair.right->fair.parent = y;
+        }
+
+        fair_transplant(cpu, z, y);
+        y->fair.left = z->fair.left;
+        y->fair.left->fair.parent = y;
+        y->fair.red = z->fair.red;
+    }
+
+    if (!y_red) fair_erase_fixup(cpu, x, x_parent);
+
+    z->fair.left   = NULL;
+    z->fair.right  = NULL;
+    z->fair.parent = NULL;
+}
+
+/*
+ * Moves min_vruntime forward (never back) to the smallest vruntime still
+ * competing here: the leftmost queued task, or 'curr' as it stops running.
+ */
+static void fair_update_min(cpu_context_t* cpu, task_t* curr) {
+    uint64_t min = cpu->fair_min_vruntime;
+    bool have = false;
+
+    if (curr) {
+        min = curr->fair.vruntime;
+        have = true;
+    }
+    if (cpu->fair_leftmost) {
+        uint64_t left = cpu->fair_leftmost->fair.vruntime;
+        if (!have || vruntime_before(left, min)) min = left;
+        have = true;
+    }
+
+    if (have && vruntime_before(cpu->fair_min_vruntime, min)) {
+        cpu->fair_min_vruntime = min;
+    }
+}
+
+/*
+ * Turns an absolute vruntime on 'cpu' into a lag against its min_vruntime,
+ * bounded to FAIR_LAG_MAX_NS of real CPU time at the task's weight.
+ */
+void fair_make_relative(cpu_context_t* cpu, task_t* t) {
+    int64_t limit = FAIR_LAG_MAX_NS * NICE_0_WEIGHT / t->fair.weight;
+    int64_t lag = (int64_t)(t->fair.vruntime - cpu->fair_min_vruntime);
+    if (lag >  limit) lag =  limit;
+    if (lag < -limit) lag = -limit;
+
+    t->fair.vruntime = (uint64_t)lag;
+    t->fair.relative = true;
+}
+
+static void fair_make_absolute(cpu_context_t* cpu, task_t* t) {
+    if (!t->fair.relative) return;
+    t->fair.vruntime += cpu->fair_min_vruntime;
+    t->fair.relative = false;
+}
+
+uint32_t fair_nice_weight(int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    return fair_nice_weights[nice - NICE_MIN];
+}
+
+/*
+ * Gives a task that is joining the fair class a zero lag, so it starts
+ * level with the tasks already there.
+ */
+void fair_init_task(task_t* t, int nice) {
+    t->fair.left     = NULL;
+    t->fair.right    = NULL;
+    t->fair.parent   = NULL;
+    t->fair.red      = false;
+    t->fair.vruntime = 0;
+    t->fair.relative = true;
+    t->fair.exec_start = 0;
+    fair_set_nice(t, nice);
+}
+
+/*
+ * A new weight only changes how fast vruntime grows from now on, so it can
+ * be applied whether or not the task is queued.
+ */
+void fair_set_nice(task_t* t, int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+
+    t->fair.nice   = (int8_t)nice;
+    t->fair.weight = fair_nice_weight(nice);
+}
+
+/*
+ * Inserts 't' ordered by vruntime; equal keys go right, so ties run FIFO.
+ * A task arriving from sleep, another CPU or another class is placed at
+ * min_vruntime plus the lag it left with.
+ */
+void fair_enqueue(cpu_context_t* cpu, task_t* t) {
+    fair_make_absolute(cpu, t);
+
+    t->fair.left  = NULL;
+    t->fair.right = NULL;
+    t->fair.red   = true;
+
+    task_t* parent = NULL;
+    task_t* node = cpu->fair_root;
+    bool leftmost = true;
+
+    while (node) {
+        parent = node;
+        if (vruntime_before(t->fair.vruntime, node->fair.vruntime)) {
+            node = node->fair.left;
+        } else {
+            node = node->fair.right;
+            leftmost = false;
+        }
+    }
+
+    t->fair.parent = parent;
+    if (!parent) cpu->fair_root = t;
+    else if (vruntime_before(t->fair.vruntime, parent->fair.vruntime)) parent->fair.left = t;
+    else parent->fair.right = t;
+
+    if (leftmost) cpu->fair_leftmost = t;
+    fair_insert_fixup(cpu, t);
+}
+
+/*
+ * Unlinks 't', which keeps its absolute vruntime because it is about to
+ * run on this CPU.
+ */
+void fair_dequeue(cpu_context_t* cpu, task_t* t) {
+    if (cpu->fair_leftmost == t) cpu->fair_leftmost = fair_next(t);
+    fair_erase(cpu, t);
+}
+
+/*
+ * Unlinks 't' for migration: its vruntime becomes a lag that the
+ * destination's fair_enqueue or fair_start turns back into its own time.
+ */
+void fair_detach(cpu_context_t* cpu, task_t* t) {
+    fair_dequeue(cpu, t);
+    fair_make_relative(cpu, t);
+}
+
+task_t* fair_first(cpu_context_t* cpu) {
+    return cpu->fair_leftmost;
+}
+
+/* In-order successor, NULL at the end */
+task_t* fair_next(task_t* t) {
+    if (t->fair.right) {
+        t = t->fair.right;
+        while (t->fair.left) t = t->fair.left;
+        return t;
+    }
+
+    while (t->fair.parent && t == t->fair.parent->fair.right) t = t->fair.parent;
+    return t->fair.parent;
+}
+
+/*
+ *  SCHEDULER HOOKS (IRQs off, on the task's CPU)
+ */
+
+/*
+ * 't' is about to run here: a task stolen from another CPU still carries
+ * a lag and is placed against this CPU's min_vruntime first.
+ */
+void fair_start(cpu_context_t* cpu, task_t* t, uint64_t now_ns) {
+    if (t->fair.relative) {
+        spin_lock(&cpu->rq_lock);
+        fair_make_absolute(cpu, t);
+        spin_unlock(&cpu->rq_lock);
+    }
+    t->fair.exec_start = now_ns;
+}
+
+/*
+ * 't' stops running here: charges the CPU time it used, weighted by its
+ * nice value, moves min_vruntime up and leaves 't' holding its lag.
+ * schedule() re-enqueues it right after if it is still runnable.
+ */
+void fair_stop(cpu_context_t* cpu, task_t* t, uint64_t now_ns) {
+    uint64_t delta = now_ns - t->fair.exec_start;
+    t->fair.vruntime += delta * NICE_0_WEIGHT / t->fair.weight;
+    t->fair.exec_start = now_ns;
+
+    spin_lock(&cpu->rq_lock);
+    fair_update_min(cpu, t);
+    fair_make_relative(cpu, t);
+    spin_unlock(&cpu->rq_lock);
+}
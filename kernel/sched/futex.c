@@ -0,0 +1,146 @@
+#include <futex.h>
+#include <wait_queue.h>
+#include <sched.h>
+#include <vmm.h>
+#include <vma.h>
+
+static wait_queue_t futex_buckets[FUTEX_BUCKETS];
+
+/* Fibonacci hashing: the low bits of an address are mostly alignment */
+static inline wait_queue_t* futex_bucket(const futex_key_t* key) {
+    uintptr_t h = key->addr ^ (uintptr_t)key->mm;
+    return &futex_buckets[(h * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+static inline bool futex_key_equal(const futex_key_t* a, const futex_key_t* b) {
+    return a->mm == b->mm && a->addr == b->addr;
+}
+
+void futex_init() {
+    for (int i = 0; i < FUTEX_BUCKETS; i++) {
+        wait_queue_init(&futex_buckets[i]);
+    }
+}
+
+/*
+ * Builds the key of the word at 'uaddr' in the current task. A private
+ * word is keyed by address space and virtual address, so a copy-on-write
+ * break that moves its page to a new frame keeps the key; threads share
+ * the mm and meet on it. A word in a VMA_SHARED mapping is keyed by its
+ * frame, which every address space mapping it agrees on. The word is read
+ * first so that a lazily mapped page is faulted in. Returns false if the
+ * address is unusable.
+ */
+static bool futex_key(uintptr_t uaddr, futex_key_t* key) {
+    task_t* current = sched_get_current();
+    mm_t* mm = current->mm;
+
+    if (!mm || (uaddr & 3) || uaddr + sizeof(uint32_t) > 0x00007FFFFFFFFFFF) return false;
+
+    mutex_lock(&mm->vma_mutex);
+    vma_area_t* vma = vma_find(current, uaddr);
+    uint32_t flags = vma ? vma->vm_flags : 0;
+    mutex_unlock(&mm->vma_mutex);
+    if (!vma) return false;
+
+    (void)*(volatile uint32_t*)uaddr;
+
+    if (flags & VMA_SHARED) {
+        key->mm   = NULL;
+        key->addr = vmm_virtual_to_physical(vmm_get_table(mm->cr3), uaddr);
+        return key->addr != 0;
+    }
+
+    key->mm   = mm;
+    key->addr = uaddr;
+    return true;
+}
+
+/*
+ * Sleeps while the word at 'uaddr' holds 'val'. The value is checked
+ * under the bucket lock that futex_wake() takes, so a wake issued after
+ * the waker changed the word cannot be missed. timeout_ms = 0 waits
+ * without limit.
+ */
+int futex_wait(uintptr_t uaddr, uint32_t val, uint64_t timeout_ms) {
+    futex_key_t key;
+    if (!futex_key(uaddr, &key)) return FUTEX_EFAULT;
+
+    task_t* current = sched_get_current();
+    wait_queue_t* wq = futex_bucket(&key);
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&wq->lock);
+
+    // Through the HHDM: the bucket lock must not be held across a page fault.
+    // The walk sees the current frame, so a copy-on-write break by a thread
+    // that then wakes us is either visible here or happens after we queue.
+    uintptr_t phys = vmm_virtual_to_physical(vmm_get_table(current->cr3), uaddr);
+    if (!phys) {
+        spin_unlock(&wq->lock);
+        spin_irq_restore(f);
+        return FUTEX_EFAULT;
+    }
+
+    if (__atomic_load_n((volatile uint32_t*)phys_to_virt(phys), __ATOMIC_SEQ_CST) != val) {
+        spin_unlock(&wq->lock);
+        spin_irq_restore(f);
+        return FUTEX_EAGAIN;
+    }
+
+    current->futex_key = key;
+    wait_queue_add_locked(wq, current);
+
+    spin_unlock(&wq->lock);
+    spin_irq_restore(f);
+
+    bool woken = true;
+    if (timeout_ms) woken = wait_sleep_timeout(wq, timeout_ms);
+    else wait_sleep(wq);
+
+    current->futex_key = (futex_key_t){ NULL, 0 };
+    return woken ? FUTEX_WOKEN : FUTEX_ETIMEDOUT;
+}
+
+/*
+ * Wakes up to 'count' tasks waiting on the word at 'uaddr', oldest first.
+ * Other keys sharing the bucket are skipped. Returns the number woken,
+ * or FUTEX_EFAULT.
+ */
+int futex_wake(uintptr_t uaddr, uint32_t count) {
+    futex_key_t key;
+    if (!futex_key(uaddr, &key)) return FUTEX_EFAULT;
+
+    wait_queue_t* wq = futex_bucket(&key);
+    task_t* woken = NULL;
+    int n = 0;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&wq->lock);
+
+    task_t* t = wq->head;
+    while (t && (uint32_t)n < count) {
+        task_t* next = t->wait_next;
+
+        if (futex_key_equal(&t->futex_key, &key)) {
+            wait_queue_remove_locked(wq, t);
+            t->wait_next = woken;
+            woken = t;
+            n++;
+        }
+        t = next;
+    }
+
+    spin_unlock(&wq->lock);
+
+    // Woken in reverse order of the list; they are all runnable at once anyway
+    while (woken) {
+        task_t* next = woken->wait_next;
+        woken->wait_next = NULL;
+        wait_queue_wake_task(woken);
+        woken = next;
+    }
+    spin_irq_restore(f);
+
+    return n;
+}
@@ -0,0 +1,172 @@
+#include <rt.h>
+#include <sched.h>
+#include <cpu.h>
+#include <timer.h>
+#include <timer_wheel.h>
+
+static spinlock_t rt_lock_ = { .ticket = 0, .current = 0, .last_cpu = -1 };  // Every cpu->rt_util
+
+/*
+ * Replenishment timer: the throttled task's period is over. enqueue_task
+ * starts the new period and routes the task to its admitted CPU.
+ */
+static void rt_replenish(ktimer_t* timer) {
+    task_t* t = (task_t*)timer->data;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&t->state_lock);
+    t->rt.throttled = false;
+    spin_unlock(&t->state_lock);
+    spin_irq_restore(f);
+
+    sched_wake_task(t);
+}
+
+void rt_init_task(task_t* t) {
+    t->rt.runtime_ns  = 0;
+    t->rt.period_ns   = 0;
+    t->rt.budget_ns   = 0;
+    t->rt.deadline_ns = 0;
+    t->rt.exec_start  = 0;
+    t->rt.util        = 0;
+    t->rt.cpu         = -1;
+    t->rt.throttled   = false;
+    ktimer_init(&t->rt.timer, rt_replenish, t);
+}
+
+/*
+ * Admission control: reserves runtime/period of one CPU for 't', on the
+ * allowed CPU with the most spare real-time bandwidth (worst fit spreads
+ * the load). A CPU never takes more than RT_UTIL_MAX, so the lower classes
+ * always keep a share. An already admitted task is re-admitted with the
+ * new parameters, or keeps its old ones if they do not fit. The next
+ * enqueue starts a fresh period. Returns 0, or -1 if nothing fits.
+ */
+int rt_admit(task_t* t, uint64_t runtime_ms, uint64_t period_ms) {
+    if (!runtime_ms || runtime_ms > period_ms || period_ms > RT_PERIOD_MAX_MS) return -1;
+
+    uint32_t util = (uint32_t)((runtime_ms << RT_UTIL_SHIFT) / period_ms);
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&rt_lock_);
+
+    cpu_context_t* old = t->rt.cpu >= 0 ? get_cpu_by_id(t->rt.cpu) : NULL;
+    if (old) old->rt_util -= t->rt.util;
+
+    cpu_context_t* best = NULL;
+    for (int i = 0; i < 32; i++) {
+        cpu_context_t* cpu = get_cpu_by_id(i);
+        if (!cpu || !cpumask_test(&t->affinity, i)) continue;
+        if (cpu->rt_util + util > RT_UTIL_MAX) continue;
+
+        if (!best || cpu->rt_util < best->rt_util) best = cpu;
+    }
+
+    if (!best) {
+        if (old) old->rt_util += t->rt.util;
+        spin_unlock(&rt_lock_);
+        spin_irq_restore(f);
+        return -1;
+    }
+
+    best->rt_util += util;
+
+    t->rt.util        = util;
+    t->rt.cpu         = (int32_t)best->cpu_id;
+    t->rt.runtime_ns  = runtime_ms * 1000000;
+    t->rt.period_ns   = period_ms * 1000000;
+    t->rt.budget_ns   = 0;
+    t->rt.deadline_ns = ktime_get_ns();
+
+    spin_unlock(&rt_lock_);
+    spin_irq_restore(f);
+    return 0;
+}
+
+/*
+ * Gives the task's bandwidth back to its CPU (leaving the class or exiting).
+ */
+void rt_release(task_t* t) {
+    uint64_t f = spin_irq_save();
+    spin_lock(&rt_lock_);
+
+    cpu_context_t* cpu = t->rt.cpu >= 0 ? get_cpu_by_id(t->rt.cpu) : NULL;
+    if (cpu) cpu->rt_util -= t->rt.util;
+
+    t->rt.util = 0;
+    t->rt.cpu  = -1;
+
+    spin_unlock(&rt_lock_);
+    spin_irq_restore(f);
+}
+
+/*
+ * Inserts 't' into the PRIO_RT list ordered by absolute deadline (EDF),
+ * after any task with the same deadline. Real-time tasks are few and
+ * pinned, so a sorted list is enough. Caller holds cpu->rq_lock.
+ */
+void rt_enqueue(cpu_context_t* cpu, task_t* t) {
+    task_t** link = &cpu->rq_head[PRIO_RT];
+
+    while (*link && !rt_deadline_before(t->rt.deadline_ns, (*link)->rt.deadline_ns)) {
+        link = &(*link)->sched_next;
+    }
+
+    t->sched_next = *link;
+    *link = t;
+    if (!t->sched_next) cpu->rq_tail[PRIO_RT] = t;
+}
+
+/*
+ * Decides whether 't' may be queued now. Past its deadline it starts a new
+ * period with a full budget; within the period it runs while budget is
+ * left. Otherwise it is throttled: it sleeps until the replenishment timer
+ * fires at its deadline, so an overrunning task cannot eat into other
+ * tasks' reservations.
+ *
+ * The decision is made under t->state_lock, so it cannot race with a
+ * wakeup. Only the first throttle of a period arms the timer, on the CPU
+ * the task was admitted on.
+ */
+bool rt_runnable(task_t* t, uint64_t now_ns) {
+    uint64_t f = spin_irq_save();
+    spin_lock(&t->state_lock);
+
+    bool runnable = true;
+    bool arm = false;
+
+    if (!rt_deadline_before(now_ns, t->rt.deadline_ns)) {
+        t->rt.deadline_ns = now_ns + t->rt.period_ns;
+        t->rt.budget_ns   = (int64_t)t->rt.runtime_ns;
+    } else if (t->rt.budget_ns <= 0) {
+        // Off every runqueue until rt_replenish wakes it
+        t->state = TASK_SLEEPING;
+        t->on_rq = false;
+        runnable = false;
+
+        arm = !t->rt.throttled;
+        t->rt.throttled = true;
+    }
+
+    spin_unlock(&t->state_lock);
+
+    if (arm) {
+        cpu_context_t* cpu = t->rt.cpu >= 0 ? get_cpu_by_id(t->rt.cpu) : NULL;
+        if (!cpu) cpu = get_cpu();
+        ktimer_add_on(cpu, &t->rt.timer, (t->rt.deadline_ns + 999999) / 1000000);
+        if (cpu != get_cpu()) sched_kick_cpu(cpu);
+    }
+
+    spin_irq_restore(f);
+    return runnable;
+}
+
+void rt_start(task_t* t, uint64_t now_ns) {
+    t->rt.exec_start = now_ns;
+}
+
+/* Charges the time 't' just ran against its budget */
+void rt_stop(task_t* t, uint64_t now_ns) {
+    t->rt.budget_ns -= (int64_t)(now_ns - t->rt.exec_start);
+    t->rt.exec_start = now_ns;
+}
@@ -3,33 +3,54 @@
 #include <timer.h>
 #include <serial.h>
 #include <kmalloc.h>
+#include <slab.h>
+#include <panic.h>
 #include <pmm.h>
 #include <vmm.h>
 #include <vma.h>
 #include <atomic.h>
 #include <std_funcs.h>
+#include <apic.h>
+#include <timer_wheel.h>
+#include <fair.h>
+#include <rt.h>
+#include <vdso.h>
+#include <futex.h>
+
+slab_cache_t* task_cache  = NULL;
 
 task_t* root_task          = NULL;
 task_t* dead_task_list     = NULL;
-task_t* blocked_task_list  = NULL;
 
 spinlock_t sched_lock_    = { .ticket = 0, .current = 0, .last_cpu = -1 };
 spinlock_t dead_lock_     = { .ticket = 0, .current = 0, .last_cpu = -1 };  // task_exit, sched_reap
-spinlock_t sleep_lock_    = { .ticket = 0, .current = 0, .last_cpu = -1 };  // sched_update_sleepers
-spinlock_t blocked_lock_  = { .ticket = 0, .current = 0, .last_cpu = -1 };  // sched_block_current, sched_wakeup
 
-static const uint32_t priority_quanta[] = { 10, 5, 2, 1 };  // High, Normal, Low, Idle
+// Picks a level may take in a row while lower levels wait: High, Normal, Low, Idle bands
+static inline uint32_t priority_quanta(int p) {
+    if (p < PRIO_NORMAL) return 10;
+    if (p < PRIO_LOW)    return 5;
+    if (p < PRIO_IDLE)   return 2;
+    return 1;
+}
+
+// Levels dequeue/steal may pick from: everything but the idle level
+#define RQ_RUNNABLE_MASK (~(1ULL << PRIO_IDLE))
+
+// Bits of the levels strictly less urgent than p
+static inline uint64_t rq_levels_below(int p) {
+    return p >= 63 ? 0 : ~0ULL << (p + 1);
+}
 
 /*
  * The Idle Task: The ultimate fallback for the CPU when no tasks are ready.
- * It keeps the processor in a low-power state (HLT). On CPU 0, this task 
- * also acts as the 'Reaper', responsible for deallocating ZOMBIE tasks 
- * to prevent memory leaks in the scheduler.
+ * It keeps the processor in a low-power state (HLT). Every idle task also
+ * acts as the 'Reaper', responsible for deallocating ZOMBIE tasks to
+ * prevent memory leaks in the scheduler; CPU 0 also flushes the log.
  */
 static void idle_task() {
     while (1) {
+        sched_reap();
         if (get_cpu()->cpu_id == 0) {
-             sched_reap();
              log_flush();
         }
         for(volatile int i=0; i<500; i++) __asm__ volatile("pause");
@@ -37,10 +58,156 @@ static void idle_task() {
     }
 }
 
+/* 'a' should take the CPU from 'b': a more urgent level, or an earlier EDF deadline */
+static inline bool sched_preempts(task_t* a, task_t* b) {
+    if (a->priority != b->priority) return a->priority < b->priority;
+    return a->policy == SCHED_POLICY_RT && b->policy == SCHED_POLICY_RT &&
+           rt_deadline_before(a->rt.deadline_ns, b->rt.deadline_ns);
+}
+
+/*
+ * Tells 'target' that 'task' was just queued on it. The target is only
+ * interrupted if it is idle or running less urgent work (task == NULL: only
+ * if idle). A remote target gets a reschedule IPI; resched_ipi_pending
+ * coalesces a burst of wakeups into one IPI until the target handles it.
+ * The local CPU just sets need_resched, which interrupt_dispatch honours
+ * on the way out of the current interrupt.
+ * The fence orders the caller's runqueue update against the reads of the
+ * target's state; the idle side publishes its state before re-checking
+ * its bitmap (sched_program_tick).
+ */
+static void sched_resched_cpu(cpu_context_t* target, task_t* task) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    task_t* curr = target->current_task;
+    bool idle = target->tick_stopped || !curr || curr == target->idle_task;
+    if (!idle && (!task || !sched_preempts(task, curr))) return;
+
+    if (target == get_cpu()) {
+        target->need_resched = true;
+        return;
+    }
+
+    if (__atomic_exchange_n(&target->resched_ipi_pending, true, __ATOMIC_ACQ_REL)) return;
+    lapic_send_ipi(target->lapic_id, IPI_VECTOR_RESCHED);
+}
+
+/*
+ * Wakes one idle CPU other than 'self' (one 't' may run on, if given), so
+ * it can steal work queued on 'self' or reap 't'.
+ */
+static void sched_kick_idle(cpu_context_t* self, task_t* t) {
+    for (int i = 0; i < 32; i++) {
+        cpu_context_t* other = get_cpu_by_id(i);
+        if (!other || other == self) continue;
+        if (t && !sched_task_allowed(t, other)) continue;
+        if (!other->tick_stopped && other->current_task != other->idle_task) continue;
+
+        sched_resched_cpu(other, NULL);
+        return;
+    }
+}
+
+/*
+ * A timer was added to 'cpu''s wheel from another CPU: an idle target
+ * reprograms its tick, which may be stopped or set for a later event.
+ */
+void sched_kick_cpu(cpu_context_t* cpu) {
+    sched_resched_cpu(cpu, NULL);
+}
+
+/*
+ * Programs this CPU's next timer event: one slice ahead while it has a task,
+ * or the next timer wheel event, whichever comes first. An idle CPU with
+ * an empty wheel stops its tick entirely until a reschedule IPI or device
+ * IRQ arrives. Runs after current_task is published.
+ */
+static void sched_program_tick(cpu_context_t* cpu, task_t* next, uint64_t now) {
+    uint64_t expires = TW_NEVER;
+    if (next != cpu->idle_task) expires = now + SCHED_TICK_MS;
+
+    // A real-time task is stopped as soon as its budget runs out
+    if (next->policy == SCHED_POLICY_RT) {
+        int64_t left = next->rt.budget_ns > 0 ? next->rt.budget_ns : 0;
+        uint64_t left_ms = ((uint64_t)left + 999999) / 1000000;
+        if (!left_ms) left_ms = 1;
+        if (now + left_ms < expires) expires = now + left_ms;
+    }
+
+    uint64_t wheel_next = timer_wheel_next_event(cpu);
+    if (wheel_next < expires) expires = wheel_next;
+
+    if (next == cpu->idle_task) {
+        if (expires == TW_NEVER) cpu->tick_stopped = true;
+
+        // Pairs with sched_resched_cpu: work queued before we looked idle
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (cpu->rq_bitmap & RQ_RUNNABLE_MASK) {
+            cpu->tick_stopped = false;
+            expires = now;
+        } else if (expires == TW_NEVER) {
+            lapic_timer_stop();
+            return;
+        }
+    }
+
+    lapic_timer_arm(expires > now ? expires - now : 1);
+}
+
 /*
  *  RUNQUEUE SECTION
  */
+
+/*
+ * Appends 'task' to level p, or inserts it into the vruntime tree at
+ * PRIO_FAIR or the deadline-ordered list at PRIO_RT. Caller holds
+ * cpu->rq_lock.
+ */
+static void rq_append(cpu_context_t* cpu, task_t* task, int p) {
+    task->sched_next = NULL;
+    if (p == PRIO_FAIR) {
+        fair_enqueue(cpu, task);
+    } else if (p == PRIO_RT) {
+        rt_enqueue(cpu, task);
+    } else {
+        if (cpu->rq_tail[p]) {
+            cpu->rq_tail[p]->sched_next = task;
+        } else {
+            cpu->rq_head[p] = task;
+        }
+        cpu->rq_tail[p] = task;
+    }
+    cpu->rq_count[p]++;
+    cpu->rq_nr_queued++;
+    cpu->rq_bitmap |= 1ULL << p;
+}
+
+/*
+ * Switches a task that is in no runqueue to the class sched_set_policy()
+ * asked for. A task joining the fair class starts with no lag.
+ */
+static void sched_apply_policy(task_t* task) {
+    task->policy = task->policy_next;
+
+    if (task->policy == SCHED_POLICY_FAIR) {
+        fair_init_task(task, task->fair.nice);
+        task->base_priority = PRIO_FAIR;
+    } else if (task->policy == SCHED_POLICY_RT) {
+        task->base_priority = PRIO_RT;
+    } else {
+        task->base_priority = PRIO_NORMAL;
+    }
+}
+
 void enqueue_task(cpu_context_t* cpu, task_t* task) {
+    if (task->policy_next != task->policy) sched_apply_policy(task);
+
+    // A real-time task out of budget waits for its replenishment timer instead
+    if (task->policy == SCHED_POLICY_RT && !rt_runnable(task, ktime_get_ns())) return;
+
+    // Never queue a task where its affinity mask forbids it to run
+    if (!sched_task_allowed(task, cpu)) cpu = sched_select_cpu(task, cpu);
+
     spin_lock(&cpu->rq_lock);
 
     task->priority = task->base_priority;
@@ -49,54 +216,55 @@ void enqueue_task(cpu_context_t* cpu, task_t* task) {
     if (p >= PRIORITY_LEVELS) p = PRIO_NORMAL;
     cpu->current_quanta[p] = 0; 
 
-    task->sched_next = NULL;
-    if (cpu->rq_tail[p]) {
-        cpu->rq_tail[p]->sched_next = task;
-    } else {
-        cpu->rq_head[p] = task;
-    }
-    cpu->rq_tail[p] = task;
-    cpu->rq_count[p]++;
+    rq_append(cpu, task, p);
 
-    // If task is "homeless" pin to it's CPU
-    if (task->cpu_id == (uint64_t)-1) {
-        task->cpu_id = cpu->cpu_id;
-    }
+    task->cpu_id = cpu->cpu_id;
 
     spin_unlock(&cpu->rq_lock);
+
+    // An idle or busy-with-less-urgent-work target would otherwise wait for its tick
+    sched_resched_cpu(cpu, task);
 }
 
+/*
+ * Picks the next task in O(1): the first set bit of the ready bitmap is the
+ * most urgent non-empty level. A level that used up its quanta is passed
+ * over once if a less urgent level has work, which keeps lower levels from
+ * starving.
+ */
 task_t* dequeue_task(cpu_context_t* cpu) {
     spin_lock(&cpu->rq_lock);
 
-    for (int p = 0; p < PRIORITY_LEVELS - 1; p++) {
-        if (!cpu->rq_head[p]) {
-            cpu->current_quanta[p] = 0;
-            continue;
-        }
+    uint64_t ready = cpu->rq_bitmap & RQ_RUNNABLE_MASK;
+    while (ready) {
+        int p = __builtin_ctzll(ready);
 
-        if (cpu->current_quanta[p] >= priority_quanta[p]) {
-            bool work_below = false;
-            for (int low = p + 1; low < PRIORITY_LEVELS - 1; low++) {
-                if (cpu->rq_head[low]) {
-                    work_below = true;
-                    break;
-                }
-            }
-            if (work_below) {
-                cpu->current_quanta[p] = 0;
-                continue; 
-            }
+        // Real-time levels are never passed over; their budgets bound them instead
+        if (p >= PRIO_HIGH && cpu->current_quanta[p] >= priority_quanta(p)) {
             cpu->current_quanta[p] = 0;
+            if (ready & rq_levels_below(p)) {
+                ready &= ready - 1;
+                continue;
+            }
         }
 
-        task_t* t = cpu->rq_head[p];
-        cpu->rq_head[p] = t->sched_next;
-        if (!cpu->rq_head[p]) {
-            cpu->rq_tail[p] = NULL;
+        task_t* t;
+        if (p == PRIO_FAIR) {
+            // Fair class: always the smallest vruntime
+            t = fair_first(cpu);
+            fair_dequeue(cpu, t);
+            if (!cpu->fair_root) cpu->rq_bitmap &= ~(1ULL << p);
+        } else {
+            t = cpu->rq_head[p];
+            cpu->rq_head[p] = t->sched_next;
+            if (!cpu->rq_head[p]) {
+                cpu->rq_tail[p] = NULL;
+                cpu->rq_bitmap &= ~(1ULL << p);
+            }
         }
         
         cpu->rq_count[p]--;
+        cpu->rq_nr_queued--;
         cpu->current_quanta[p]++;
 
         spin_unlock(&cpu->rq_lock);
@@ -108,139 +276,84 @@ task_t* dequeue_task(cpu_context_t* cpu) {
 }
 
 /*
- * Iterates through the local list of sleeping tasks and wakes up those 
- * whose sleep duration has expired. To prevent deadlocks (AB-BA), it first 
- * extracts tasks from the sleeping list under local 'sleep_lock' and then 
- * enqueues them into their respective CPU runqueues.
+ * Makes a sleeping or blocked task runnable, on its last CPU unless another
+ * one is less loaded. A task that has not been through schedule() since it
+ * went to sleep is still on its CPU: it just gets TASK_RUNNING back and
+ * schedule() keeps it runnable. Otherwise it is queued, but only once its
+ * old CPU has moved off its kernel stack, so two CPUs never run one stack.
  */
-void sched_update_sleepers() {
-    cpu_context_t* cpu = get_cpu();
-    uint64_t now = get_uptime_ms();
-    
-    task_t* ready_queue = NULL;
-
+void sched_wake_task(task_t* t) {
     uint64_t f = spin_irq_save();
-    spin_lock(&cpu->sleep_lock);
-
-    while (cpu->sleeping_list && now >= cpu->sleeping_list->sleep_until) {
-        task_t* t = cpu->sleeping_list;
-        cpu->sleeping_list = t->sched_next;
+    spin_lock(&t->state_lock);
 
-        t->sched_next = ready_queue;
-        ready_queue = t;
+    if (t->on_rq) {
+        if (t->state != TASK_READY) t->state = TASK_RUNNING;
+        spin_unlock(&t->state_lock);
+        spin_irq_restore(f);
+        return;
     }
 
-    spin_unlock(&cpu->sleep_lock);
+    t->on_rq = true;
+    t->state = TASK_READY;
+    spin_unlock(&t->state_lock);
 
-    while (ready_queue) {
-        task_t* t = ready_queue;
-        ready_queue = t->sched_next;
+    // Its CPU may be between schedule() and the stack switch in the stubs
+    while (__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE)) __asm__ volatile("pause");
 
-        t->state = TASK_READY;
-        t->sched_next = NULL;
+    cpu_context_t* prev = get_cpu_by_id(t->cpu_id);
+    if (!prev) prev = get_cpu();
 
-        enqueue_task(cpu, t);
-    }
+    t->sched_next = NULL;
+    enqueue_task(sched_select_cpu(t, prev), t);
     spin_irq_restore(f);
 }
 
 /*
- * Transitions the current task into the TASK_SLEEPING state and calculates 
- * its wake-up time. The task is then inserted into the 'sleeping_task_list' 
- * in a sorted manner (by wake-up time) to allow efficient processing 
- * during scheduler updates.
+ * Called by the interrupt and syscall stubs right after they loaded the
+ * next task's frame into RSP. Nothing runs on the previous task's kernel
+ * stack any more, so it may now be queued and run elsewhere; a runnable
+ * task that may no longer run here is queued on another CPU now.
  */
-void sched_make_task_sleep(uint64_t ms) {
-    task_t* current = sched_get_current();
-    if (!current) return;
-
+void sched_switch_done() {
     cpu_context_t* cpu = get_cpu();
-    current->state = TASK_SLEEPING;
-    current->sleep_until = get_uptime_ms() + ms;
-
-    uint64_t f = spin_irq_save();
-    spin_lock(&cpu->sleep_lock);
-
-    task_t** pp = &cpu->sleeping_list;
+    task_t* prev = cpu->switch_prev;
+    if (!prev) return;
 
-    while (*pp && (*pp)->sleep_until < current->sleep_until) {
-        pp = &((*pp)->sched_next);
-    }
+    task_t* requeue = cpu->switch_requeue;
+    cpu->switch_prev    = NULL;
+    cpu->switch_requeue = NULL;
+    __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
 
-    current->sched_next = *pp;
-    *pp = current;
-
-    spin_unlock(&cpu->sleep_lock);
-    spin_irq_restore(f);
+    if (requeue) enqueue_task(cpu, requeue);
 }
 
 /*
- * Blocks the current task and adds it to the blocked list with a specific reason.
- * The task remains in TASK_BLOCKED state until a matching sched_wakeup is called.
+ * Sleep timer callback: runs on the sleeper's CPU from the timer interrupt
+ * and puts the task back on that CPU's runqueue, or a less loaded one.
  */
-void sched_block_current(task_reason_t reason) {
-    task_t* current = sched_get_current();
-    if (!current) return;
-
-    uint64_t f = spin_irq_save();
-    spin_lock(&blocked_lock_);
-
-    current->state = TASK_BLOCKED;
-    current->wait_reason = reason;
-    current->sched_next  = blocked_task_list;
-    blocked_task_list    = current;
-
-    spin_unlock(&blocked_lock_);
-    spin_irq_restore(f);
+static void sched_sleep_expired(ktimer_t* timer) {
+    sched_wake_task((task_t*)timer->data);
 }
 
 /*
- * Wakes up all tasks from the blocked list that match the specified reason.
- * Transitions tasks to TASK_READY and re-inserts them into their respective 
- * CPU runqueues. Uses a two-phase approach to minimize lock contention.
+ * Transitions the current task into the TASK_SLEEPING state and arms its
+ * sleep timer on this CPU's timer wheel (O(1), no sorted insert).
  */
-void sched_wakeup(task_reason_t reason) {
-    task_t* tasks_to_wake = NULL;
-
-    uint64_t f = spin_irq_save();
-    spin_lock(&blocked_lock_);
-
-    task_t** pp = &blocked_task_list;
-
-    while (*pp) {
-        task_t* t = *pp;
-        if (t->wait_reason == reason) {
-            *pp = t->sched_next;
-
-            t->sched_next = tasks_to_wake;
-            tasks_to_wake = t;
-            t->state = TASK_READY;
-        } else {
-            pp = &((*pp)->sched_next);
-        }
-    }
-    
-    spin_unlock(&blocked_lock_);
-    spin_irq_restore(f);
+void sched_make_task_sleep(uint64_t ms) {
+    task_t* current = sched_get_current();
+    if (!current) return;
 
-    while (tasks_to_wake) {
-        task_t* t = tasks_to_wake;
-        tasks_to_wake = t->sched_next;
+    current->state = TASK_SLEEPING;
 
-        cpu_context_t* target_cpu = get_cpu_by_id(t->cpu_id);
-        if (!target_cpu) target_cpu = get_cpu();
-        
-        enqueue_task(target_cpu, t);
-    }
-    
+    ktimer_init(&current->sleep_timer, sched_sleep_expired, current);
+    ktimer_add(&current->sleep_timer, get_uptime_ms() + ms);
 }
 
 /*
  * Allocates and initializes the idle task structure for a specific CPU.
  */
 static task_t* create_idle_struct(void (*entry)(void)) {
-    task_t* t = kmalloc(sizeof(task_t));
-    memset(t, 0, sizeof(task_t));
+    task_t* t = kmem_cache_alloc(task_cache);
     
     uint64_t stack_size = 4096;
     t->stack_base = (uintptr_t)kmalloc(stack_size); 
@@ -260,71 +373,338 @@ static task_t* create_idle_struct(void (*entry)(void)) {
     frame->vector_number = 0;
     frame->error_code = 0;
 
-    t->cr3        = read_cr3(); 
+    t->cr3        = read_cr3() & ~CR3_PCID_MASK; 
     t->is_user    = false;
     t->stack_size = stack_size;
     t->rsp        = (uintptr_t)frame;
     t->tid        = 1;  // TID 1 reserved for Idle tasks
     t->state      = TASK_RUNNING;
+    t->state_lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+    t->on_rq      = true;
     t->cpu_id     = get_cpu()->cpu_id;
     t->priority   = PRIO_IDLE;
+    t->base_priority = PRIO_IDLE;
+    t->policy     = SCHED_POLICY_MLFQ;
+    t->policy_next = SCHED_POLICY_MLFQ;
+    rt_init_task(t);
+    cpumask_only(&t->affinity, t->cpu_id);
     vma_init_task(t);
 
     return t;
 }
 
 /*
- * Attempts to steal a migratable user task (TID >= 10) from another CPU's 
- * runqueue to balance load. Respects priority levels and uses trylock 
- * to avoid deadlocks during synchronization.
+ * A queued task may move to 'dest' if its mask allows it and no CPU is
+ * still on its kernel stack (a preempted task requeued by its own
+ * schedule() is queued before the stub switches away from it).
  */
-static task_t* steal_task_from_cpu(cpu_context_t* other) {
-    if (!spin_trylock(&other->rq_lock)) return NULL;
+static inline bool rq_can_migrate(task_t* t, cpu_context_t* dest) {
+    return !__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE) && sched_task_allowed(t, dest);
+}
 
-    task_t* stolen = NULL;
-    for (int p = 0; p < PRIORITY_LEVELS - 1; p++) {
-        task_t* curr = other->rq_head[p];
+/*
+ * Unlinks up to 'want' tasks that may move to 'dest' from 'cpu's
+ * runqueue, most urgent levels first, and returns them as a sched_next
+ * list. Caller holds cpu->rq_lock.
+ */
+static task_t* rq_detach_batch(cpu_context_t* cpu, cpu_context_t* dest, uint32_t want) {
+    task_t* batch = NULL;
+    task_t** batch_tail = &batch;
+    uint32_t taken = 0;
+
+    uint64_t ready = cpu->rq_bitmap & RQ_RUNNABLE_MASK;
+    while (ready && taken < want) {
+        int p = __builtin_ctzll(ready);
+        ready &= ready - 1;
+
+        if (p == PRIO_FAIR) {
+            // Smallest vruntimes first; the successor survives the erase
+            task_t* curr = fair_first(cpu);
+            while (curr && taken < want) {
+                task_t* next = fair_next(curr);
+
+                if (rq_can_migrate(curr, dest)) {
+                    fair_detach(cpu, curr);
+                    cpu->rq_count[p]--;
+                    cpu->rq_nr_queued--;
+
+                    curr->sched_next = NULL;
+                    *batch_tail = curr;
+                    batch_tail = &curr->sched_next;
+                    taken++;
+                }
+                curr = next;
+            }
+
+            if (!cpu->fair_root) cpu->rq_bitmap &= ~(1ULL << p);
+            continue;
+        }
+
+        task_t* curr = cpu->rq_head[p];
         task_t* prev = NULL;
 
-        while (curr) {
-            if (curr->tid >= 10) {
-                if (prev) prev->sched_next = curr->sched_next;
-                else other->rq_head[p] = curr->sched_next;
+        while (curr && taken < want) {
+            task_t* next = curr->sched_next;
+
+            if (rq_can_migrate(curr, dest)) {
+                if (prev) prev->sched_next = next;
+                else cpu->rq_head[p] = next;
+                if (cpu->rq_tail[p] == curr) cpu->rq_tail[p] = prev;
+
+                cpu->rq_count[p]--;
+                cpu->rq_nr_queued--;
 
-                if (other->rq_tail[p] == curr) other->rq_tail[p] = prev;
-                
-                other->rq_count[p]--;
                 curr->sched_next = NULL;
-                stolen = curr;
-                break;
+                *batch_tail = curr;
+                batch_tail = &curr->sched_next;
+                taken++;
+            } else {
+                prev = curr;
             }
-            prev = curr;
-            curr = curr->sched_next;
+            curr = next;
         }
-        if (stolen) break;
+
+        if (!cpu->rq_head[p]) cpu->rq_bitmap &= ~(1ULL << p);
     }
 
+    return batch;
+}
+
+/*
+ * Queues a detached batch on 'cpu', each task keeping its level.
+ */
+static void rq_attach_batch(cpu_context_t* cpu, task_t* batch) {
+    spin_lock(&cpu->rq_lock);
+    while (batch) {
+        task_t* next = batch->sched_next;
+        batch->cpu_id = cpu->cpu_id;
+        rq_append(cpu, batch, batch->priority < PRIORITY_LEVELS ? batch->priority : PRIO_NORMAL);
+        batch = next;
+    }
+    spin_unlock(&cpu->rq_lock);
+}
+
+/*
+ * Moves up to half of 'other's tasks that may run on 'cpu', at most SCHED_STEAL_MAX,
+ * onto 'cpu'. Returns the first one to run right away; the rest are
+ * queued locally. Uses trylock on the victim to avoid deadlocks, and never
+ * holds both runqueue locks at once.
+ */
+static task_t* steal_tasks_from_cpu(cpu_context_t* cpu, cpu_context_t* other) {
+    if (!spin_trylock(&other->rq_lock)) return NULL;
+
+    uint32_t want = (other->rq_nr_queued + 1) / 2;
+    if (want > SCHED_STEAL_MAX) want = SCHED_STEAL_MAX;
+
+    task_t* batch = rq_detach_batch(other, cpu, want);
     spin_unlock(&other->rq_lock);
-    return stolen;
+    if (!batch) return NULL;
+
+    task_t* rest = batch->sched_next;
+    batch->sched_next = NULL;
+    if (rest) rq_attach_batch(cpu, rest);
+
+    return batch;
+}
+
+/* Steal domains, nearest (cheapest to migrate across) first */
+enum {
+    SCHED_DOMAIN_SMT,       // Same core: shares L1/L2
+    SCHED_DOMAIN_LLC,       // Same last-level cache
+    SCHED_DOMAIN_ALL,
+    SCHED_DOMAINS
+};
+
+static bool cpu_in_domain(cpu_context_t* a, cpu_context_t* b, int domain) {
+    if (domain == SCHED_DOMAIN_SMT) return a->core_id == b->core_id;
+    if (domain == SCHED_DOMAIN_LLC) return a->llc_id == b->llc_id;
+    return true;
+}
+
+/*
+ * Busiest CPU in 'self's 'domain' that is not in 'tried': the longest
+ * runqueue, ties going to the higher load average. Reads the other CPUs'
+ * counters without their locks; a stale pick only costs a failed steal.
+ */
+static cpu_context_t* sched_find_busiest(cpu_context_t* self, int domain, uint32_t tried) {
+    cpu_context_t* busiest = NULL;
+    uint32_t busiest_queued = 0;
+
+    for (int i = 0; i < 32; i++) {
+        cpu_context_t* other = get_cpu_by_id(i);
+        if (!other || other == self || (tried & (1u << i))) continue;
+        if (!cpu_in_domain(self, other, domain)) continue;
+
+        uint32_t queued = __atomic_load_n(&other->rq_nr_queued, __ATOMIC_RELAXED);
+        if (!queued) continue;
+
+        if (!busiest || queued > busiest_queued ||
+            (queued == busiest_queued && other->load_avg > busiest->load_avg)) {
+            busiest = other;
+            busiest_queued = queued;
+        }
+    }
+    return busiest;
+}
+
+/*
+ * Work stealing for an empty local runqueue: SMT siblings first, then CPUs
+ * sharing the LLC, then everyone, taking from the busiest victim of each
+ * domain. A victim that yields nothing (lock contended, only tasks whose
+ * affinity excludes us) is skipped for the rest of the search.
+ */
+static task_t* sched_steal(cpu_context_t* cpu) {
+    uint32_t tried = 0;
+
+    for (int domain = 0; domain < SCHED_DOMAINS; domain++) {
+        cpu_context_t* victim;
+        while ((victim = sched_find_busiest(cpu, domain, tried))) {
+            task_t* t = steal_tasks_from_cpu(cpu, victim);
+            if (t) return t;
+            tried |= 1u << victim->cpu_id;
+        }
+    }
+    return NULL;
 }
 
+/*
+ * Folds the number of tasks runnable here since the last update into the
+ * load average, once per elapsed tick: load += (runnable - load) / 8.
+ * A long tickless stretch is folded in at most 64 steps, after which the
+ * old history is gone anyway.
+ */
+static void sched_update_load(cpu_context_t* cpu, uint32_t runnable, uint64_t now) {
+    uint64_t periods = (now - cpu->load_stamp) / SCHED_TICK_MS;
+    if (!periods) return;
+    cpu->load_stamp += periods * SCHED_TICK_MS;
+
+    uint64_t sample = (uint64_t)runnable * SCHED_LOAD_SCALE;
+    if (periods >= 64) {
+        cpu->load_avg = (uint32_t)sample;
+        return;
+    }
+
+    uint64_t load = cpu->load_avg;
+    while (periods--) {
+        load = (load * ((1 << SCHED_LOAD_SHIFT) - 1) + sample) >> SCHED_LOAD_SHIFT;
+    }
+    cpu->load_avg = (uint32_t)load;
+}
+
+/* Tasks on 'cpu' right now: queued plus the running one, unless idle */
+static inline uint32_t cpu_nr_running(cpu_context_t* cpu) {
+    uint32_t n = __atomic_load_n(&cpu->rq_nr_queued, __ATOMIC_RELAXED);
+    task_t* curr = cpu->current_task;
+    if (curr && curr != cpu->idle_task) n++;
+    return n;
+}
+
+/*
+ * Least loaded CPU other than 'self' that 't' may run on (any CPU if 't'
+ * is NULL), NULL if there is none. Equal loads go to a CPU sharing
+ * 'self's LLC.
+ */
+static cpu_context_t* sched_find_idlest(cpu_context_t* self, task_t* t, uint32_t* load_out) {
+    cpu_context_t* idlest = NULL;
+    uint32_t idlest_load = 0;
+
+    for (int i = 0; i < 32; i++) {
+        cpu_context_t* other = get_cpu_by_id(i);
+        if (!other || other == self) continue;
+        if (t && !sched_task_allowed(t, other)) continue;
+
+        uint32_t load = cpu_nr_running(other);
+        if (!idlest || load < idlest_load ||
+            (load == idlest_load && other->llc_id == self->llc_id && idlest->llc_id != self->llc_id)) {
+            idlest = other;
+            idlest_load = load;
+        }
+    }
+
+    *load_out = idlest_load;
+    return idlest;
+}
+
+/*
+ * Picks the runqueue for a new or woken task: the least loaded CPU in its
+ * affinity mask, with 'prev' (the creating CPU, or where the task last ran
+ * and its cache is warm) kept unless another CPU is strictly less busy.
+ * Falls back to 'prev' only if the mask names no online CPU.
+ */
+cpu_context_t* sched_select_cpu(task_t* t, cpu_context_t* prev) {
+    uint32_t load;
+    cpu_context_t* idlest = sched_find_idlest(prev, t, &load);
+
+    if (!sched_task_allowed(t, prev)) return idlest ? idlest : prev;
+    if (idlest && load < cpu_nr_running(prev)) return idlest;
+    return prev;
+}
+
+/*
+ * Periodic push balancing, run by a busy CPU every SCHED_BALANCE_MS: if it
+ * has at least two tasks more than the least loaded CPU, and its load
+ * average shows the backlog is not a momentary spike, it hands half the
+ * difference over. This covers CPUs that are busy but not empty, which
+ * never steal.
+ */
+static void sched_balance(cpu_context_t* cpu) {
+    uint32_t target_load;
+    cpu_context_t* target = sched_find_idlest(cpu, NULL, &target_load);
+    if (!target) return;
+
+    uint32_t load = cpu_nr_running(cpu);
+    if (load < target_load + 2) return;
+    if (cpu->load_avg <= (target_load + 1) * SCHED_LOAD_SCALE) return;
+
+    uint32_t want = (load - target_load) / 2;
+    if (want > SCHED_STEAL_MAX) want = SCHED_STEAL_MAX;
+
+    spin_lock(&cpu->rq_lock);
+    task_t* batch = rq_detach_batch(cpu, target, want);
+    spin_unlock(&cpu->rq_lock);
+    if (!batch) return;
+
+    rq_attach_batch(target, batch);
+    sched_resched_cpu(target, NULL);
+}
+
+/*
+ * Lifts every waiting level above PRIO_HIGH one band up (clamped at
+ * PRIO_HIGH). Levels are walked most urgent first, so each list moves
+ * exactly once per boost. The fair class is left alone: vruntime already
+ * keeps its tasks from starving each other. Remote CPUs enqueue, steal
+ * and balance on these lists, so the walk runs under cpu->rq_lock.
+ */
 static void prio_boost(cpu_context_t* cpu) {
-    for (int p = PRIO_HIGH; p < PRIO_LOW; p++) {
-        if (cpu->rq_head[p + 1] == NULL) continue;
+    spin_lock(&cpu->rq_lock);
 
-        if (cpu->rq_tail[p]) {
-            cpu->rq_tail[p]->sched_next = cpu->rq_head[p + 1];
+    uint64_t levels = cpu->rq_bitmap & RQ_RUNNABLE_MASK & rq_levels_below(PRIO_HIGH) & ~(1ULL << PRIO_FAIR);
+
+    while (levels) {
+        int src = __builtin_ctzll(levels);
+        levels &= levels - 1;
+
+        int dst = src - PRIORITY_BAND;
+        if (dst < PRIO_HIGH) dst = PRIO_HIGH;
+
+        if (cpu->rq_tail[dst]) {
+            cpu->rq_tail[dst]->sched_next = cpu->rq_head[src];
         } else {
-           cpu->rq_head[p] = cpu->rq_head[p + 1];
+           cpu->rq_head[dst] = cpu->rq_head[src];
         }
 
-        cpu->rq_tail[p] = cpu->rq_tail[p + 1];
-        cpu->rq_count[p] += cpu->rq_count[p + 1];
+        cpu->rq_tail[dst] = cpu->rq_tail[src];
+        cpu->rq_count[dst] += cpu->rq_count[src];
 
-        cpu->rq_head[p + 1] = NULL;
-        cpu->rq_tail[p + 1] = NULL;
-        cpu->rq_count[p + 1] = 0;
+        cpu->rq_head[src] = NULL;
+        cpu->rq_tail[src] = NULL;
+        cpu->rq_count[src] = 0;
+
+        cpu->rq_bitmap &= ~(1ULL << src);
+        cpu->rq_bitmap |= 1ULL << dst;
     }
+
+    spin_unlock(&cpu->rq_lock);
 }
 
 /*
@@ -333,24 +713,37 @@ static void prio_boost(cpu_context_t* cpu) {
 void sched_init() {
     cpu_context_t* cpu = get_cpu();
     
+    // Tasks are packed 64-byte aligned in their own cache
+    task_cache = kmem_cache_create("task_t", sizeof(task_t), _Alignof(task_t), NULL);
+    if (!task_cache) kpanic("SCHED: Failed to create task cache!");
+
     // Convert current execution flow into the 'Main' task (TID 0)
-    task_t* main_task = kmalloc(sizeof(task_t));
-    memset(main_task, 0, sizeof(task_t));
+    task_t* main_task = kmem_cache_alloc(task_cache);
     
     main_task->tid = 0;
     vma_init_task(main_task);
     main_task->state = TASK_RUNNING;
+    main_task->state_lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+    main_task->on_rq  = true;
+    main_task->on_cpu = true;
     main_task->next = main_task;
     main_task->prev = main_task;
 
     main_task->cpu_id = cpu->cpu_id;
+    cpumask_only(&main_task->affinity, cpu->cpu_id);
+    main_task->policy = SCHED_POLICY_MLFQ;
+    main_task->policy_next = SCHED_POLICY_MLFQ;
+    rt_init_task(main_task);
     main_task->is_user = false;
-    main_task->cr3 = read_cr3();
+    main_task->cr3 = read_cr3() & ~CR3_PCID_MASK;
     main_task->stack_size = 0;
     
     root_task = main_task;
     cpu->current_task = main_task;
     cpu->idle_task = create_idle_struct(idle_task);
+
+    timer_wheel_init_cpu(cpu);
+    futex_init();
 }
 
 /*
@@ -364,7 +757,17 @@ uint64_t schedule(interrupt_frame_t* frame) {
     
     cpu_context_t* cpu = get_cpu();
     task_t* current = cpu->current_task;
-    uint64_t now = get_uptime_ms();
+    uint64_t now_ns = ktime_get_ns();
+    uint64_t now = now_ns / 1000000;
+
+    cpu->need_resched = false;
+
+    sched_update_load(cpu, cpu->rq_nr_queued + (current && current != cpu->idle_task), now);
+
+    if (now >= cpu->next_balance) {
+        if (current && current != cpu->idle_task) sched_balance(cpu);
+        cpu->next_balance = now + SCHED_BALANCE_MS;
+    }
 
     if (now >= cpu->next_priority_boost) {
         prio_boost(cpu);
@@ -373,32 +776,42 @@ uint64_t schedule(interrupt_frame_t* frame) {
 
     if (current) {
         current->rsp = (uintptr_t)frame;
-        if (current && current->state == TASK_RUNNING && current->priority != PRIO_IDLE) {
-            current->state = TASK_READY;
-            enqueue_task(cpu, current); 
-        }
-
-        // Reset affinity for user tasks to allow migration
-        if (current->tid >= 10) {
-            current->cpu_id = (uint64_t)-1;
+        if (current->policy == SCHED_POLICY_FAIR) fair_stop(cpu, current, now_ns);
+        if (current->policy == SCHED_POLICY_RT)   rt_stop(current, now_ns);
+
+        // Decided under state_lock: a concurrent sched_wake_task() either
+        // lands before (the task stays runnable) or finds it off the CPU
+        spin_lock(&current->state_lock);
+        bool requeue = current->state == TASK_RUNNING && current->priority != PRIO_IDLE;
+        if (requeue) current->state = TASK_READY;
+        else if (current != cpu->idle_task) current->on_rq = false;
+        spin_unlock(&current->state_lock);
+
+        // One that has to run elsewhere (new mask or real-time CPU) is handed
+        // over by sched_switch_done(), once this CPU has left its stack
+        if (requeue) {
+            if (current->policy_next != current->policy) sched_apply_policy(current);
+            if (sched_task_allowed(current, cpu)) {
+                enqueue_task(cpu, current);
+            } else {
+                if (current->policy == SCHED_POLICY_FAIR && !current->fair.relative) fair_make_relative(cpu, current);
+                cpu->switch_requeue = current;
+            }
         }
     }
 
-    // 1. Fetch task from local runqueue
+    // 1. Fetch task from local runqueue; one whose affinity changed while queued moves on
     task_t* scheduled_next = dequeue_task(cpu);
+    while (scheduled_next && !sched_task_allowed(scheduled_next, cpu)) {
+        if (scheduled_next->policy == SCHED_POLICY_FAIR) fair_make_relative(cpu, scheduled_next);
+        if (scheduled_next == current) cpu->switch_requeue = current;
+        else enqueue_task(cpu, scheduled_next);
+        scheduled_next = dequeue_task(cpu);
+    }
 
-    // 2. Load Balancing: Attempt to steal from other cores if idle
+    // 2. Load Balancing: steal from the nearest busy cores if idle
     if (!scheduled_next) {
-        for (int i = 0; i < 32; i++) {
-            cpu_context_t* other = get_cpu_by_id(i);
-            if (!other || other == cpu) continue;
-
-            scheduled_next = steal_task_from_cpu(other);
-            
-            if (scheduled_next) {
-                break;
-            }
-        }
+        scheduled_next = sched_steal(cpu);
     }
 
     // 3. Final fallback
@@ -406,18 +819,38 @@ uint64_t schedule(interrupt_frame_t* frame) {
         scheduled_next = cpu->idle_task;
     }
 
-    // Update task and CPU state
+    // Work left waiting here: wake an idle CPU so it can steal it
+    if (cpu->rq_bitmap & RQ_RUNNABLE_MASK) {
+        sched_kick_idle(cpu, NULL);
+    }
+
+    // Update task and CPU state; the stubs clear the old task's on_cpu
+    if (current && scheduled_next != current) cpu->switch_prev = current;
+    scheduled_next->on_cpu = true;
     scheduled_next->state = TASK_RUNNING;
     scheduled_next->cpu_id = cpu->cpu_id;
     cpu->current_task = scheduled_next;
+    if (scheduled_next != current) vdso_switch(cpu->cpu_id, scheduled_next->tid);
+    if (scheduled_next->policy == SCHED_POLICY_FAIR) fair_start(cpu, scheduled_next, now_ns);
+    if (scheduled_next->policy == SCHED_POLICY_RT)   rt_start(scheduled_next, now_ns);
+
+    // 4. Next timer event (none if idle with no timers)
+    sched_program_tick(cpu, scheduled_next, now);
 
     // Update TSS/Kernel stack for next interrupt/syscall
     cpu->tss.rsp0 = (uintptr_t)scheduled_next->stack_base + scheduled_next->stack_size;
     cpu->kernel_stack = cpu->tss.rsp0;
 
-    // Address space switch if necessary
-    if (scheduled_next->cr3 != 0 && scheduled_next->cr3 != read_cr3()) {
-        write_cr3(scheduled_next->cr3);
+    // Address space switch if necessary (PCID-tagged when available).
+    // Threads of one process share cr3, so switching between them is free.
+    if (scheduled_next->cr3 != 0) {
+        vmm_switch_address_space(scheduled_next->cr3);
+    }
+
+    // Thread-local storage of the incoming user task
+    if (scheduled_next->is_user && scheduled_next->fs_base != cpu->fs_base) {
+        write_msr(MSR_FS_BASE, scheduled_next->fs_base);
+        cpu->fs_base = scheduled_next->fs_base;
     }
 
     spin_irq_restore(f);
@@ -432,7 +865,10 @@ uint64_t schedule(interrupt_frame_t* frame) {
 void sched_init_ap() {
     cpu_context_t* cpu = get_cpu();
     cpu->idle_task = create_idle_struct(idle_task); 
+    cpu->idle_task->on_cpu = true;
     cpu->current_task = cpu->idle_task;
+
+    timer_wheel_init_cpu(cpu);
 }
 
 /*
@@ -446,6 +882,17 @@ void task_exit() {
     task_t* current = sched_get_current();
     if (!current) return;
 
+    // Real-time bandwidth goes back to its CPU
+    if (current->rt.cpu >= 0) rt_release(current);
+    ktimer_cancel(&current->rt.timer);
+
+    // A thread's stack goes back to its process here, where the shared
+    // vma_mutex may be waited for; the idle task reaping it must not sleep
+    if (current->ustack_base && current->mm) {
+        vma_unmap(current, current->ustack_base, THREAD_STACK_SIZE);
+        current->ustack_base = 0;
+    }
+
     // 2. Lock scheduler
     uint64_t f = spin_irq_save();
     spin_lock(&dead_lock_);
@@ -454,19 +901,22 @@ void task_exit() {
 
     // 3. Add to global "cleanup later" list 
     current->state = TASK_ZOMBIE;
-    current->cpu_id = (uint64_t)-1;
     current->sched_next = dead_task_list;
     dead_task_list = current;
 
     spin_unlock(&dead_lock_);
     spin_irq_restore(f);
 
+    // Reap on an idle CPU the task was allowed on, so exits never disturb
+    // CPUs reserved for other work; otherwise this CPU reaps once it idles
+    sched_kick_idle(get_cpu(), current);
+
     // 4. Trigger immediate reschedule via timer interrupt vector
     while(1) { sched_yield(); __asm__ volatile("hlt"); }
 }
 
 /*
- * The Kernel Reaper: Executed by the Idle task (typically on CPU 0).
+ * The Kernel Reaper: Executed by the Idle task of any CPU.
  * It drains the 'dead_task_list', unlinks tasks from the global
  * 'root_task' list, and physically frees their kernel stacks and structures. 
  */
@@ -489,6 +939,19 @@ void sched_reap() {
     while (to_clean) {
         task_t* next_zombie = to_clean->sched_next;
 
+        // Still on its CPU's stack (between task_exit and the switch away): retry later
+        if (__atomic_load_n(&to_clean->on_cpu, __ATOMIC_ACQUIRE)) {
+            uint64_t f = spin_irq_save();
+            spin_lock(&dead_lock_);
+            to_clean->sched_next = dead_task_list;
+            dead_task_list = to_clean;
+            spin_unlock(&dead_lock_);
+            spin_irq_restore(f);
+
+            to_clean = next_zombie;
+            continue;
+        }
+
         uint64_t f = spin_irq_save();
         spin_lock(&sched_lock_);
 
@@ -509,16 +972,131 @@ void sched_reap() {
 
         kprintf("[REAPER] Cleaning up TID %d\n", (int)to_clean->tid);
 
-        // Only proper user tasks (TID >= 10) have full memory maps to destroy
+        // Only proper user tasks (TID >= 10) have full memory maps to destroy.
+        // This only drops the mm reference (no lock); the last user frees it.
         if (to_clean->tid >= 10) vma_destroy_all(to_clean);
 
         // 3. Finally free space and update "to_clean" list
         kfree((void*)to_clean->stack_base);
-        kfree(to_clean);
+        kmem_cache_free(task_cache, to_clean);
         to_clean = next_zombie;
     }
 }
 
+/*
+ * Looks up a live task created by arch_task_* ('tid' 0 = the caller).
+ * Main and idle tasks are never returned. Caller holds sched_lock_.
+ */
+static task_t* sched_find_task_locked(uint64_t tid) {
+    task_t* current = sched_get_current();
+    task_t* found = NULL;
+
+    if (tid == 0 || tid == current->tid) {
+        found = current;
+    } else if (root_task) {
+        task_t* t = root_task;
+        do {
+            if (t->tid == tid && t->state != TASK_ZOMBIE) { found = t; break; }
+            t = t->next;
+        } while (t != root_task);
+    }
+
+    return (found && found->tid >= 10) ? found : NULL;
+}
+
+/*
+ * Replaces the affinity mask of task 'tid' (0 = the caller). The mask must
+ * name at least one online CPU. A queued task moves when it is next picked,
+ * a running one when it is next switched out; the caller yields right away
+ * if it is no longer allowed where it runs. Returns 0, or -1 if the task
+ * does not exist or the mask is unusable.
+ */
+int sched_set_affinity(uint64_t tid, const cpumask_t* mask) {
+    bool online = false;
+    for (int i = 0; i < 32 && !online; i++) {
+        if (get_cpu_by_id(i) && cpumask_test(mask, i)) online = true;
+    }
+    if (!online) return -1;
+
+    task_t* current = sched_get_current();
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&sched_lock_);
+
+    // Idle and main tasks stay pinned
+    task_t* target = sched_find_task_locked(tid);
+    if (target) target->affinity = *mask;
+
+    spin_unlock(&sched_lock_);
+    spin_irq_restore(f);
+
+    if (!target) return -1;
+    if (target == current && !sched_task_allowed(current, get_cpu())) sched_yield();
+    return 0;
+}
+
+/*
+ * Moves task 'tid' (0 = the caller) to scheduling class 'policy' with the
+ * given nice value (used by the fair class, clamped to -20..19). The nice
+ * value applies at once; the class switch happens the next time the task
+ * is queued, since it cannot leave a runqueue it is sitting in. The
+ * caller yields so its own switch is immediate. Returns 0 or -1.
+ */
+int sched_set_policy(uint64_t tid, sched_policy_t policy, int nice) {
+    // Real-time needs admission, see sched_set_deadline()
+    if (policy >= SCHED_POLICY_COUNT || policy == SCHED_POLICY_RT) return -1;
+
+    task_t* current = sched_get_current();
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&sched_lock_);
+
+    task_t* target = sched_find_task_locked(tid);
+    if (target) {
+        fair_set_nice(target, nice);
+        target->policy_next = policy;
+        if (target->rt.cpu >= 0) rt_release(target);
+    }
+
+    spin_unlock(&sched_lock_);
+    spin_irq_restore(f);
+
+    if (!target) return -1;
+    if (target == current && policy != current->policy) sched_yield();
+    return 0;
+}
+
+/*
+ * Makes task 'tid' (0 = the caller) a real-time task that gets 'runtime_ms'
+ * of CPU every 'period_ms', scheduled EDF with the period as its relative
+ * deadline. Admission control reserves the bandwidth on one allowed CPU
+ * and pins the task there. runtime_ms == 0 leaves the class (back to
+ * MLFQ). Returns 0, or -1 if the task does not exist or no CPU has room.
+ */
+int sched_set_deadline(uint64_t tid, uint64_t runtime_ms, uint64_t period_ms) {
+    task_t* current = sched_get_current();
+    int res = -1;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&sched_lock_);
+
+    task_t* target = sched_find_task_locked(tid);
+    if (target && runtime_ms == 0) {
+        rt_release(target);
+        target->policy_next = SCHED_POLICY_MLFQ;
+        res = 0;
+    } else if (target && rt_admit(target, runtime_ms, period_ms) == 0) {
+        target->policy_next = SCHED_POLICY_RT;
+        res = 0;
+    }
+
+    spin_unlock(&sched_lock_);
+    spin_irq_restore(f);
+
+    if (res == 0 && target == current) sched_yield();
+    return res;
+}
+
 task_t* sched_get_current() {
     return get_cpu()->current_task;
 }
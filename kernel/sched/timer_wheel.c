@@ -0,0 +1,266 @@
+#include <timer_wheel.h>
+#include <timer.h>
+#include <cpu.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <panic.h>
+#include <std_funcs.h>
+
+_Static_assert(sizeof(timer_wheel_t) <= PAGE_SIZE, "timer_wheel_t must fit in one frame");
+
+/*
+ *  UNLOCKED SECTION (callers hold wheel->lock)
+ */
+static inline uint64_t rotr64(uint64_t x, int n) {
+    return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+/*
+ * Files a timer by its distance from the wheel clock: within 64ms it lands
+ * in its exact level-0 slot, otherwise in the level whose slot width covers
+ * the distance. Higher levels are cascaded down as the clock reaches them.
+ */
+static void tw_enqueue(timer_wheel_t* w, ktimer_t* t) {
+    uint64_t expires = t->expires < w->clk ? w->clk : t->expires;
+    uint64_t delta = expires - w->clk;
+
+    // Beyond the last level: park at the horizon, requeued when it comes due
+    if (delta > TW_MAX_DELTA) {
+        delta = TW_MAX_DELTA;
+        expires = w->clk + TW_MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TW_SLOT_BITS))) {
+        level++;
+    }
+    int slot = (expires >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK;
+
+    ktimer_t** head = &w->slots[level][slot];
+    t->next = *head;
+    if (*head) (*head)->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+
+    t->wheel = w;
+    t->level = level;
+    t->slot  = slot;
+    w->pending[level] |= 1ULL << slot;
+}
+
+static void tw_dequeue(timer_wheel_t* w, ktimer_t* t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+
+    if (!w->slots[t->level][t->slot]) {
+        w->pending[t->level] &= ~(1ULL << t->slot);
+    }
+    t->next  = NULL;
+    t->pprev = NULL;
+}
+
+/* Detaches a whole slot, returning its list */
+static ktimer_t* tw_take_slot(timer_wheel_t* w, int level, int slot) {
+    ktimer_t* list = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->pending[level] &= ~(1ULL << slot);
+    return list;
+}
+
+/*
+ * Earliest clock value at which the wheel has work: a level-0 expiry or a
+ * higher-level cascade. A level's slots are reached at multiples of its
+ * slot width, so rotating its bitmap to the next such boundary and taking
+ * the lowest set bit finds the next one in O(1) per level.
+ */
+static uint64_t tw_next_event(timer_wheel_t* w) {
+    uint64_t best = TW_NEVER;
+
+    for (int level = 0; level < TW_LEVELS; level++) {
+        if (!w->pending[level]) continue;
+
+        int shift = level * TW_SLOT_BITS;
+        uint64_t width = 1ULL << shift;
+        uint64_t base = (w->clk + width - 1) & ~(width - 1);
+        int idx = (base >> shift) & TW_SLOT_MASK;
+
+        uint64_t at = base + (uint64_t)__builtin_ctzll(rotr64(w->pending[level], idx)) * width;
+        if (at < best) best = at;
+    }
+    return best;
+}
+
+/*
+ *  LOCKED SECTION
+ */
+
+/*
+ * Gives the current CPU its wheel, starting at the present uptime.
+ */
+void timer_wheel_init_cpu(cpu_context_t* cpu) {
+    void* frame = pmm_alloc_frame();
+    if (!frame) kpanic("TIMER: Out of memory for timer wheel");
+
+    timer_wheel_t* w = (timer_wheel_t*)phys_to_virt((uintptr_t)frame);
+
+    memset(w, 0, sizeof(timer_wheel_t));
+    w->lock = (spinlock_t){ .ticket = 0, .current = 0, .last_cpu = -1 };
+    w->clk  = get_uptime_ms();
+
+    cpu->timers = w;
+}
+
+void ktimer_init(ktimer_t* timer, ktimer_fn_t fn, void* data) {
+    timer->next    = NULL;
+    timer->pprev   = NULL;
+    timer->expires = 0;
+    timer->fn      = fn;
+    timer->data    = data;
+    timer->wheel   = NULL;
+    timer->running = false;
+}
+
+/*
+ * Arms 'timer' to fire at uptime 'expires' (ms) on the current CPU's wheel.
+ * A timer that is already pending is moved. O(1).
+ */
+void ktimer_add(ktimer_t* timer, uint64_t expires) {
+    ktimer_add_on(get_cpu(), timer, expires);
+}
+
+/*
+ * Same as ktimer_add(), on 'cpu''s wheel; the callback then runs on that
+ * CPU. The caller must be the only one arming 'timer'.
+ */
+void ktimer_add_on(cpu_context_t* cpu, ktimer_t* timer, uint64_t expires) {
+    if (ktimer_pending(timer)) ktimer_cancel(timer);
+
+    timer_wheel_t* w = cpu->timers;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&w->lock);
+
+    timer->expires = expires;
+    tw_enqueue(w, timer);
+
+    spin_unlock(&w->lock);
+    spin_irq_restore(f);
+}
+
+/*
+ * Removes a pending timer. O(1). Returns false if it was not queued, which
+ * includes a callback that has already been detached for running.
+ */
+bool ktimer_cancel(ktimer_t* timer) {
+    timer_wheel_t* w = timer->wheel;
+    if (!w) return false;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&w->lock);
+
+    bool was_pending = ktimer_pending(timer) && timer->wheel == w;
+    if (was_pending) tw_dequeue(w, timer);
+
+    spin_unlock(&w->lock);
+    spin_irq_restore(f);
+    return was_pending;
+}
+
+/*
+ * ktimer_cancel that also waits out a callback already running on another
+ * CPU, so the caller may reuse or free the timer's owner afterwards.
+ */
+bool ktimer_cancel_sync(ktimer_t* timer) {
+    bool was_pending = ktimer_cancel(timer);
+
+    while (__atomic_load_n(&timer->running, __ATOMIC_ACQUIRE)) {
+        __asm__ volatile("pause");
+    }
+    return was_pending;
+}
+
+/*
+ * Uptime (ms) of the next wheel event on 'cpu', TW_NEVER if it is empty.
+ * Used by the tickless scheduler to program the LAPIC timer.
+ */
+uint64_t timer_wheel_next_event(cpu_context_t* cpu) {
+    timer_wheel_t* w = cpu->timers;
+    if (!w) return TW_NEVER;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&w->lock);
+    uint64_t next = tw_next_event(w);
+    spin_unlock(&w->lock);
+    spin_irq_restore(f);
+
+    return next;
+}
+
+/*
+ * Advances the current CPU's wheel to the present and runs what expired.
+ * Called from the timer interrupt. The clock jumps straight between events
+ * (cascade points and level-0 expiries), so a long tickless idle costs
+ * no more than the events that actually occurred in it. Expired timers are
+ * collected under the lock and their callbacks run after it is dropped,
+ * so a callback may re-arm its own timer.
+ */
+void timer_wheel_run() {
+    timer_wheel_t* w = get_cpu()->timers;
+    if (!w) return;
+
+    uint64_t now = get_uptime_ms();
+    ktimer_t* expired = NULL;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&w->lock);
+
+    while (1) {
+        uint64_t at = tw_next_event(w);
+        if (at > now) break;
+        w->clk = at;
+
+        // 1. Cascade every level whose slot boundary is 'at', top-down
+        for (int level = TW_LEVELS - 1; level > 0; level--) {
+            int shift = level * TW_SLOT_BITS;
+            if (at & ((1ULL << shift) - 1)) continue;
+
+            ktimer_t* t = tw_take_slot(w, level, (at >> shift) & TW_SLOT_MASK);
+            while (t) {
+                ktimer_t* next = t->next;
+                tw_enqueue(w, t);
+                t = next;
+            }
+        }
+
+        // 2. Expire level 0; timers parked at the horizon go back in
+        ktimer_t* t = tw_take_slot(w, 0, at & TW_SLOT_MASK);
+        while (t) {
+            ktimer_t* next = t->next;
+            if (t->expires > at) {
+                tw_enqueue(w, t);
+            } else {
+                t->pprev   = NULL;
+                t->running = true;
+                t->next    = expired;
+                expired    = t;
+            }
+            t = next;
+        }
+
+        w->clk = at + 1;
+    }
+
+    if (w->clk <= now) w->clk = now + 1;
+
+    spin_unlock(&w->lock);
+
+    while (expired) {
+        ktimer_t* t = expired;
+        expired = t->next;
+        t->next = NULL;
+        t->fn(t);
+        __atomic_store_n(&t->running, false, __ATOMIC_RELEASE);
+    }
+
+    spin_irq_restore(f);
+}
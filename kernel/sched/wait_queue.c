@@ -0,0 +1,190 @@
+#include <wait_queue.h>
+#include <sched.h>
+#include <cpu.h>
+#include <timer.h>
+#include <timer_wheel.h>
+
+/*
+ *  UNLOCKED SECTION (callers hold wq->lock)
+ */
+
+/*
+ * Queues 't' at the tail as TASK_BLOCKED. The caller yields once the lock
+ * is dropped; schedule() does not requeue a blocked task. A wakeup that
+ * comes before that yield leaves the task running (sched_wake_task).
+ */
+void wait_queue_add_locked(wait_queue_t* wq, task_t* t) {
+    t->state      = TASK_BLOCKED;
+    t->wait_queue = wq;
+    t->wait_next  = NULL;
+    t->wait_prev  = wq->tail;
+
+    if (wq->tail) wq->tail->wait_next = t;
+    else wq->head = t;
+    wq->tail = t;
+}
+
+/*
+ * Unlinks 't', which must be queued on 'wq'. O(1).
+ */
+void wait_queue_remove_locked(wait_queue_t* wq, task_t* t) {
+    if (t->wait_prev) t->wait_prev->wait_next = t->wait_next;
+    else wq->head = t->wait_next;
+
+    if (t->wait_next) t->wait_next->wait_prev = t->wait_prev;
+    else wq->tail = t->wait_prev;
+
+    t->wait_next  = NULL;
+    t->wait_prev  = NULL;
+    t->wait_queue = NULL;
+}
+
+/*
+ * Unlinks and returns the oldest waiter, NULL if there is none.
+ */
+task_t* wait_queue_pop_locked(wait_queue_t* wq) {
+    task_t* t = wq->head;
+    if (t) wait_queue_remove_locked(wq, t);
+    return t;
+}
+
+/*
+ * Makes a task popped off a wait queue runnable again, on its last CPU
+ * unless another one is less loaded.
+ */
+void wait_queue_wake_task(task_t* t) {
+    sched_wake_task(t);
+}
+
+/*
+ *  LOCKED SECTION
+ */
+void wait_queue_init(wait_queue_t* wq) {
+    *wq = (wait_queue_t)WAIT_QUEUE_INIT;
+}
+
+/*
+ * First half of a wait: queues the current task before the caller's final
+ * condition check, so a wakeup that races with the check is not lost.
+ */
+void wait_prepare(wait_queue_t* wq) {
+    task_t* current = sched_get_current();
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&wq->lock);
+    wait_queue_add_locked(wq, current);
+    spin_unlock(&wq->lock);
+    spin_irq_restore(f);
+}
+
+/*
+ * The condition came true after wait_prepare. If nobody has woken us yet we
+ * simply leave the queue. Otherwise a waker popped us and is about to set
+ * us running (we never went through schedule(), so it does not queue us);
+ * wait for that, so the wakeup cannot land in a later wait.
+ */
+void wait_cancel(wait_queue_t* wq) {
+    task_t* current = sched_get_current();
+    bool still_queued = false;
+
+    uint64_t f = spin_irq_save();
+    spin_lock(&wq->lock);
+    if (current->wait_queue == wq) {
+        wait_queue_remove_locked(wq, current);
+        current->state = TASK_RUNNING;
+        still_queued = true;
+    }
+    spin_unlock(&wq->lock);
+    spin_irq_restore(f);
+
+    if (!still_queued) {
+        while (__atomic_load_n(&current->state, __ATOMIC_ACQUIRE) != TASK_RUNNING) __asm__ volatile("pause");
+    }
+}
+
+/*
+ * Second half of a wait: gives up the CPU until a wake_up_* call.
+ */
+void wait_sleep(wait_queue_t* wq) {
+    (void)wq;
+    sched_yield();
+}
+
+/*
+ * Timer callback for wait_sleep_timeout, runs on the CPU that armed it.
+ * Only wakes the task if it is still queued, i.e. nobody beat the timer.
+ */
+static void wait_timeout_expired(ktimer_t* timer) {
+    task_t* t = (task_t*)timer->data;
+    wait_queue_t* wq = t->wait_queue;
+    if (!wq) return;
+
+    spin_lock(&wq->lock);
+    bool timed_out = (t->wait_queue == wq);
+    if (timed_out) {
+        wait_queue_remove_locked(wq, t);
+        t->wait_timed_out = true;
+    }
+    spin_unlock(&wq->lock);
+
+    if (timed_out) wait_queue_wake_task(t);
+}
+
+/*
+ * Like wait_sleep, but gives up after 'ms' milliseconds. Returns false on
+ * timeout. Reuses the task's sleep timer, which is idle while it waits.
+ */
+bool wait_sleep_timeout(wait_queue_t* wq, uint64_t ms) {
+    (void)wq;
+    task_t* current = sched_get_current();
+
+    current->wait_timed_out = false;
+    ktimer_init(&current->sleep_timer, wait_timeout_expired, current);
+    ktimer_add(&current->sleep_timer, get_uptime_ms() + ms);
+
+    sched_yield();
+
+    // The callback may be running elsewhere; it must not outlive this wait
+    ktimer_cancel_sync(&current->sleep_timer);
+    return !current->wait_timed_out;
+}
+
+/*
+ * Wakes the oldest waiter. O(1).
+ */
+void wake_up_one(wait_queue_t* wq) {
+    uint64_t f = spin_irq_save();
+    spin_lock(&wq->lock);
+    task_t* t = wait_queue_pop_locked(wq);
+    spin_unlock(&wq->lock);
+
+    if (t) wait_queue_wake_task(t);
+    spin_irq_restore(f);
+}
+
+/*
+ * Wakes every waiter. The list is detached under the lock and the tasks are
+ * enqueued after it is dropped, so the cost is O(woken).
+ */
+void wake_up_all(wait_queue_t* wq) {
+    uint64_t f = spin_irq_save();
+    spin_lock(&wq->lock);
+
+    task_t* t = wq->head;
+    wq->head = NULL;
+    wq->tail = NULL;
+    for (task_t* it = t; it; it = it->wait_next) {
+        it->wait_queue = NULL;
+    }
+
+    spin_unlock(&wq->lock);
+
+    while (t) {
+        task_t* next = t->wait_next;
+        t->wait_next = NULL;
+        t->wait_prev = NULL;
+        wait_queue_wake_task(t);
+        t = next;
+    }
+    spin_irq_restore(f);
+}
@@ -11,6 +11,7 @@
 #include <serial.h>
 #include <timer.h>
 #include <sched.h>
+#include <vdso.h>
 #include <userlib.h>
 
 #include <test.h>
@@ -43,15 +44,20 @@ void kernel_main_ap(cpu_context_t* ctx) {
 
     cpu_enable_sse(); 
 
+    // Kernel writes to read-only (COW) user pages must fault here too
+    enable_wp_cr0();
+
     gdt_setup_for_cpu(ctx);
     cpu_init_context(ctx);
+    tsc_sync_target(ctx->cpu_id);
     idt_init();
 
     cpu_init_syscalls();
 
     vmm_enable_pat(); 
+    vmm_enable_pcid();
     lapic_init_ap();
-    lapic_timer_init(5, 32);
+    lapic_timer_init(SCHED_TICK_MS, 32);
     sched_init_ap();   
 
     if (g_bi) {
@@ -118,6 +124,9 @@ void smp_init_cpu(uint8_t lapic_id, uint64_t cpu_id) {
 
     // Waiting for AP
     while(config->trampoline_ready == 0) __asm__("pause");
+
+    // Let the AP measure its TSC offset against ours
+    tsc_sync_source();
 }
 
 /*
@@ -143,6 +152,9 @@ void smp_init(BootInfo* bi) {
         }
         ptr += entry->length;
     }
+
+    // Publish the final CPU count to user space
+    vdso_update();
 }
 
 /*
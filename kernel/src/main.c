@@ -12,11 +12,13 @@
 #include <test.h>
 #include <timer.h>
 #include <kmalloc.h>
+#include <slab.h>
 #include <atomic.h>
 #include <panic.h>
 #include <sched.h>
 #include <userlib.h>
 #include <syscall.h>
+#include <vdso.h>
 #include <ioapic.h>
 #include <i8042.h>
 #include <io.h>
@@ -29,7 +31,7 @@
 // Global spinlock flag
 int g_lock_enabled = 0;
 
-syscall_ptr_t sys_table[20] = { 0 };
+syscall_ptr_t sys_table[SYS_TABLE_SIZE] = { 0 };
 
 void kernel_main_high(BootInfo *bi);
 
@@ -88,6 +90,8 @@ void kernel_main_high(BootInfo *bi) {
     kprintf("###   Greetings from Higher Half!   ###\n");
     
     kmalloc_init(); 
+    vma_init();
+    vdso_init();
     kprintf("Heap initialized.\n");
 
     kprintf("Starting Coalescing Test\n");
@@ -133,7 +137,7 @@ void kernel_main_high(BootInfo *bi) {
             lapic_init(v_lapic);
             g_lock_enabled = 1;
 
-            lapic_timer_init(5, 32);
+            lapic_timer_init(SCHED_TICK_MS, 32);
 
             ioapic_init(0xFEC00000); 
             ioapic_set_irq(1, 0, 33);
@@ -202,6 +206,7 @@ void kernel_main_high(BootInfo *bi) {
     kprintf("###   Higher Half kernel is now idling.   ###\n");
 
     kmalloc_dump();
+    slab_dump_stats();
     
     while(1) {
         log_flush();
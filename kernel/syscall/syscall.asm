@@ -1,12 +1,14 @@
 [bits 64]
 global syscall_entry
 extern syscall_handler
+extern sched_switch_done
 
 ;
 ; Low-level entry point for system calls.
 ; This handler bridges the gap between the fast 'syscall' instruction
 ; and the kernel's C-level handler, creating a compatible interrupt frame.
-; Currently uses 'iretq' for maximum stability during the SMP development phase.
+; Returns with 'sysretq' when the handler hands back the frame it was given,
+; and with 'iretq' when schedule() switched to another frame (SYS_SLEEP, SYS_EXIT).
 ;
 
 syscall_entry:
@@ -15,10 +17,10 @@ syscall_entry:
     mov rsp, [gs:0x20]      ; Load kernel stack
 
     ; BUILDING FRAME
-    push qword 0x23         ; SS 
+    push qword 0x1B         ; SS (user data, GDT entry 3)
     push qword [gs:0x18]    ; RSP 
     push r11                ; RFLAGS 
-    push qword 0x1B         ; CS 
+    push qword 0x23         ; CS (user code, GDT entry 4)
     push rcx                ; RIP 
     push qword 0            ; error_code
     push qword 0            ; vector_number
@@ -41,8 +43,55 @@ syscall_entry:
     push r15
 
     mov rdi, rsp            ; Stack pointer
+    mov rbx, rsp            ; Callee-saved, restored from the frame below
     call syscall_handler 
+    cmp rax, rbx
+    jne .switched
+
+    ; FAST PATH: same task, same frame
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    add rsp, 8              ; R11 gets RFLAGS
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rbp
+    pop rbx
+    pop rdx
+    add rsp, 8              ; RCX gets RIP
+    pop rax
+
+    add rsp, 16             ; Skip vector_number and error_code
+
+    ; sysretq with a non-canonical RIP faults in Ring 0 on Intel, with the
+    ; user RSP already loaded. Anything outside the lower half goes via iretq.
+    mov rcx, [rsp]          ; RIP
+    shr rcx, 47
+    jnz .slow
+
+    ; cpu->sysret_off: iretq only (SYS_SET_SYSRET, for benchmarks)
+    cmp qword [gs:0x28], 0
+    jne .slow
+
+    mov rcx, [rsp]          ; RIP
+    mov r11, [rsp + 16]     ; RFLAGS
+    mov rsp, [rsp + 24]     ; User RSP
+    swapgs                  ; Restore user GS
+    o64 sysret
+
+.slow:
+    mov rcx, [rsp]          ; Same RCX/R11 as the sysretq path
+    mov r11, [rsp + 16]
+    swapgs
+    iretq
+
+.switched:
     mov rsp, rax            ; Allows to change task
+    call sched_switch_done  ; The old task's stack is free from here on
 
     ; RESTORE ALL REGS
     pop r15
@@ -62,6 +111,10 @@ syscall_entry:
     pop rax
 
     add rsp, 16             ; Skip vector_number and error_code
-          
+
+    ; The next task may be a kernel task (idle, kernel threads)
+    test qword [rsp + 8], 3 ; CS
+    jz .kernel_return
     swapgs                  ; Restore user GS
-    iretq                   ; !!! iretq for now, will be changed !!!
+.kernel_return:
+    iretq
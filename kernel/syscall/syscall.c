@@ -12,7 +12,7 @@ uint64_t syscall_handler(interrupt_frame_t* frame) {
     // Fetch syscall from RAX
     uintptr_t sys_num = frame->rax;
     
-    if (sys_table[sys_num] == NULL) {
+    if (sys_num >= SYS_TABLE_SIZE || sys_table[sys_num] == NULL) {
         kprintf("[SYSCALL] Unknown or unimplemented: %p\n", (uint64_t)sys_num);
         frame->rax = -1;
         return (uintptr_t)frame;
@@ -9,6 +9,7 @@
 #include <vmm.h>
 #include <pmm.h>
 #include <vma.h>
+#include <futex.h>
 #include <std_funcs.h>
 
 #include <stdint.h>
@@ -103,40 +104,44 @@ uint64_t sys_read_kbd_handler(interrupt_frame_t* frame) {
     char c;
 
     while (!kbd_pop_char(&c)) {
-        sched_block_current(REASON_KEYBOARD); 
-        sched_yield();
+        wait_event(&kbd_wait_queue, kbd_has_char());
     }
     return (uint64_t)c;
 }
 
+/*
+ * Bump allocator over the process heap, grown by whole pages through the
+ * VMA layer. heap_mutex serialises the threads sharing it.
+ */
 uint64_t sys_malloc_handler(interrupt_frame_t* frame) {
     size_t size = frame->rdi;
     if (size == 0) return 0;
     
     task_t* current = sched_get_current();
+    mm_t* mm = current->mm;
+    if (!mm) return 0;
 
     size_t aligned_size = (size + 0x0F) & ~0X0FULL;
+    uintptr_t addr = 0;
+
+    mutex_lock(&mm->heap_mutex);
+
+    if (mm->heap_curr + aligned_size > mm->heap_end) {
+        size_t needed = (mm->heap_curr + size) - mm->heap_end;
+        size_t aligned_needed = (needed + 0xFFF) & ~0xFFFULL;
 
-    if (current->heap_curr + aligned_size <= current->heap_end) {
-        uintptr_t allocated_addr = current->heap_curr;
-        current->heap_curr += aligned_size;
+        int res = vma_map(current, mm->heap_end, aligned_needed, 
+                          VMA_READ | VMA_WRITE | VMA_USER | VMA_HEAP);
+        if (res != 0) goto out;
 
-        return allocated_addr;
+        mm->heap_end += aligned_needed;
     }
 
-    size_t needed = (current->heap_curr + size) - current->heap_end;
-    size_t aligned_needed = (needed + 0xFFF) & ~0xFFFULL;
-    
-    int res = vma_map(current, current->heap_end, aligned_needed, 
-                      VMA_READ | VMA_WRITE | VMA_USER | VMA_HEAP);
-    
-    if (res != 0) return 0;
+    addr = mm->heap_curr;
+    mm->heap_curr += aligned_size;
 
-    current->heap_end += aligned_needed;
-    
-    uintptr_t addr = current->heap_curr;
-    current->heap_curr += aligned_size;
-    
+out:
+    mutex_unlock(&mm->heap_mutex);
     return (uint64_t)addr;
 }
 
@@ -147,28 +152,33 @@ uint64_t sys_free_handler(interrupt_frame_t* frame) {
     if (addr == 0 || size == 0) return 0;
 
     task_t* current = sched_get_current();
+    mm_t* mm = current->mm;
+    if (!mm) return 0;
+
     size_t aligned_size = (size + 0x0F) & ~0x0FULL;
 
-    if (addr + aligned_size == current->heap_curr) {
-        current->heap_curr = addr;
-    } else {
-        // For now, shrink only the 'logical' heap if the top is freed.
-        // Middle holes are managed by the userspace allocator.
-        return 0; 
-    }
+    mutex_lock(&mm->heap_mutex);
+
+    // For now, shrink only the 'logical' heap if the top is freed.
+    // Middle holes are managed by the userspace allocator.
+    if (addr + aligned_size != mm->heap_curr) goto out;
+    mm->heap_curr = addr;
 
-    size_t gap = current->heap_end - current->heap_curr;
+    size_t gap = mm->heap_end - mm->heap_curr;
     if (gap >= (4 * PAGE_SIZE)) {
         // Keep 1 page as a buffer to prevent "thrashing"
         size_t to_release = (gap - PAGE_SIZE) & ~0xFFFULL;
 
-        uintptr_t unmap_start = current->heap_end - to_release;
-        if (unmap_start < current->heap_curr) 
-            unmap_start = (current->heap_curr + 0xFFF) & ~0xFFFULL;
+        uintptr_t unmap_start = mm->heap_end - to_release;
+        if (unmap_start < mm->heap_curr) 
+            unmap_start = (mm->heap_curr + 0xFFF) & ~0xFFFULL;
 
         if (vma_unmap(current, unmap_start, to_release) == 0)
-            current->heap_end = unmap_start;
+            mm->heap_end = unmap_start;
     }
+
+out:
+    mutex_unlock(&mm->heap_mutex);
     return 0;
 }
 
@@ -182,6 +192,98 @@ uint64_t sys_cpu_count_handler(interrupt_frame_t* frame) {
     return (uint64_t)get_cpu_count_test();
 }
 
+uint64_t sys_fork_handler(interrupt_frame_t* frame) {
+    task_t* child = arch_task_fork(frame);
+    return child ? child->tid : (uint64_t)-1;
+}
+
+/*
+ * rdi = TID (0 = caller), rsi = user mask (64-bit words, bit n = CPU n),
+ * rdx = mask size in bytes. CPUs past the given size are cleared.
+ */
+uint64_t sys_sched_setaffinity_handler(interrupt_frame_t* frame) {
+    const uint8_t* user_mask = (const uint8_t*)frame->rsi;
+    size_t size = (size_t)frame->rdx;
+
+    if (!user_mask || size == 0 || !is_user_range(user_mask, size)) return (uint64_t)-1;
+    if (size > sizeof(cpumask_t)) size = sizeof(cpumask_t);
+
+    cpumask_t mask;
+    cpumask_clear(&mask);
+    memcpy(&mask, user_mask, size);
+
+    return (uint64_t)(int64_t)sched_set_affinity(frame->rdi, &mask);
+}
+
+/*
+ * rdi = TID (0 = caller), rsi = sched_policy_t, rdx = nice (-20..19)
+ */
+uint64_t sys_sched_setpolicy_handler(interrupt_frame_t* frame) {
+    return (uint64_t)(int64_t)sched_set_policy(frame->rdi, (sched_policy_t)frame->rsi, (int)(int64_t)frame->rdx);
+}
+
+/*
+ * rdi = TID (0 = caller), rsi = runtime (ms), rdx = period (ms); runtime 0 leaves the class
+ */
+uint64_t sys_sched_setdeadline_handler(interrupt_frame_t* frame) {
+    return (uint64_t)(int64_t)sched_set_deadline(frame->rdi, frame->rsi, frame->rdx);
+}
+
+/*
+ * rdi = address of a 32-bit word, rsi = expected value, rdx = timeout (ms, 0 = none)
+ */
+uint64_t sys_futex_wait_handler(interrupt_frame_t* frame) {
+    return (uint64_t)(int64_t)futex_wait(frame->rdi, (uint32_t)frame->rsi, frame->rdx);
+}
+
+/*
+ * rdi = address of a 32-bit word, rsi = most tasks to wake
+ */
+uint64_t sys_futex_wake_handler(interrupt_frame_t* frame) {
+    return (uint64_t)(int64_t)futex_wake(frame->rdi, (uint32_t)frame->rsi);
+}
+
+/*
+ * rdi = entry, rsi/rdx = first two arguments of the thread, r10 = FS base.
+ * Returns the new thread's TID.
+ */
+uint64_t sys_thread_create_handler(interrupt_frame_t* frame) {
+    if (!frame->rdi || frame->rdi >= 0x00007FFFFFFFF000) return (uint64_t)-1;
+    if (frame->r10 > USER_SPACE_END) return (uint64_t)-1;
+
+    task_t* t = arch_task_thread(frame->rdi, frame->rsi, frame->rdx, frame->r10);
+    return t ? t->tid : (uint64_t)-1;
+}
+
+/*
+ * rdi = new FS base of the caller (thread-local storage)
+ */
+uint64_t sys_set_tls_handler(interrupt_frame_t* frame) {
+    if (frame->rdi > USER_SPACE_END) return (uint64_t)-1;
+
+    task_t* current = sched_get_current();
+
+    uint64_t f = spin_irq_save();
+    cpu_context_t* cpu = get_cpu();
+    current->fs_base = frame->rdi;
+    write_msr(MSR_FS_BASE, frame->rdi);
+    cpu->fs_base = frame->rdi;
+    spin_irq_restore(f);
+
+    return 0;
+}
+
+/*
+ * rdi = 0: syscalls on this CPU return through iretq only, 1: sysretq
+ * when possible (default). Lets a pinned benchmark measure both paths.
+ */
+uint64_t sys_set_sysret_handler(interrupt_frame_t* frame) {
+    uint64_t f = spin_irq_save();
+    get_cpu()->sysret_off = frame->rdi ? 0 : 1;
+    spin_irq_restore(f);
+    return 0;
+}
+
 /*
  * INIT SYS TABLE
  */
@@ -198,4 +300,15 @@ void init_sys_table() {
     sys_table[SYS_FREE]       = sys_free_handler;
     sys_table[SYS_GET_TID]    = sys_get_tid_handler;
     sys_table[SYS_CPU_COUNT]  = sys_cpu_count_handler;
+    sys_table[SYS_FORK]       = sys_fork_handler;
+    sys_table[SYS_SCHED_SETAFFINITY] = sys_sched_setaffinity_handler;
+    sys_table[SYS_SCHED_SETPOLICY]   = sys_sched_setpolicy_handler;
+    sys_table[SYS_SCHED_SETDEADLINE] = sys_sched_setdeadline_handler;
+    sys_table[SYS_RING_SETUP]        = sys_ring_setup_handler;
+    sys_table[SYS_RING_ENTER]        = sys_ring_enter_handler;
+    sys_table[SYS_FUTEX_WAIT]        = sys_futex_wait_handler;
+    sys_table[SYS_FUTEX_WAKE]        = sys_futex_wake_handler;
+    sys_table[SYS_THREAD_CREATE]     = sys_thread_create_handler;
+    sys_table[SYS_SET_TLS]           = sys_set_tls_handler;
+    sys_table[SYS_SET_SYSRET]        = sys_set_sysret_handler;
 }
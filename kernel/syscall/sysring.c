@@ -0,0 +1,113 @@
+#include <syscall.h>
+#include <sysring_data.h>
+#include <sched.h>
+#include <timer.h>
+#include <vmm.h>
+#include <vma.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Runs one queued syscall through sys_table with a frame holding only
+ * its number and arguments. Calls that switch or clone the caller's own
+ * frame (exit, fork, sleep's schedule()) cannot run from a ring, and the
+ * ring calls cannot nest. Sleep is served by msleep(), which blocks the
+ * task in place.
+ */
+static int64_t sysring_run(const sysring_sqe_t* sqe) {
+    switch (sqe->op) {
+        case SYS_SLEEP:
+            if (sqe->arg[0] > 0) msleep(sqe->arg[0]);
+            return 0;
+        case SYS_EXIT:
+        case SYS_FORK:
+        case SYS_RING_SETUP:
+        case SYS_RING_ENTER:
+            return -1;
+    }
+
+    if (sqe->op >= SYS_TABLE_SIZE || sys_table[sqe->op] == NULL) return -1;
+
+    interrupt_frame_t frame = { 0 };
+    frame.rax = sqe->op;
+    frame.rdi = sqe->arg[0];
+    frame.rsi = sqe->arg[1];
+    frame.rdx = sqe->arg[2];
+
+    return (int64_t)sys_table[sqe->op](&frame);
+}
+
+/*
+ * Maps the caller's ring at SYSRING_BASE, populated and zeroed, so both
+ * queues start empty. The ring belongs to the address space, so threads
+ * of one process share it. Returns its address (also when it already
+ * exists), or -1.
+ */
+uint64_t sys_ring_setup_handler(interrupt_frame_t* frame) {
+    (void)frame;
+    task_t* current = sched_get_current();
+    mm_t* mm = current->mm;
+    if (!mm) return (uint64_t)-1;
+
+    uint64_t ret = SYSRING_BASE;
+    mutex_lock(&mm->ring_mutex);
+    if (mm->has_ring) goto out;
+
+    ret = (uint64_t)-1;
+    if (vma_map(current, SYSRING_BASE, sizeof(sysring_t), VMA_READ | VMA_WRITE | VMA_USER) != 0) goto out;
+
+    for (uintptr_t page = SYSRING_BASE; page < SYSRING_BASE + sizeof(sysring_t); page += PAGE_SIZE) {
+        if (!vma_get_page(current, page)) goto out;
+    }
+
+    mm->has_ring = true;
+    ret = SYSRING_BASE;
+
+out:
+    mutex_unlock(&mm->ring_mutex);
+    return ret;
+}
+
+/*
+ * Runs every submitted entry in order and posts a completion for each,
+ * all in one kernel entry. Stops early when the completion queue is full;
+ * the rest stays queued for the next call. The ring lives in the caller's
+ * address space and is accessed through it, like any user pointer.
+ * Returns the number of entries consumed, or -1 without a ring.
+ */
+uint64_t sys_ring_enter_handler(interrupt_frame_t* frame) {
+    (void)frame;
+    task_t* current = sched_get_current();
+    if (!current->mm || !current->mm->has_ring) return (uint64_t)-1;
+
+    // Threads share the ring: one of them drains it at a time
+    mutex_lock(&current->mm->ring_mutex);
+
+    sysring_t* ring = (sysring_t*)SYSRING_BASE;
+    uint32_t head = ring->sq_head;
+    uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    uint64_t done = 0;
+
+    // A tail more than one ring ahead is garbage, never run stale slots twice
+    if (tail - head > SYSRING_ENTRIES) tail = head + SYSRING_ENTRIES;
+
+    while (head != tail) {
+        uint32_t cq_tail = ring->cq_tail;
+        if (cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= SYSRING_ENTRIES) break;
+
+        // Copy first: the task may rewrite the slot while the call runs
+        sysring_sqe_t sqe = ring->sq[head & SYSRING_MASK];
+        __atomic_store_n(&ring->sq_head, ++head, __ATOMIC_RELEASE);
+
+        int64_t res = sysring_run(&sqe);
+
+        ring->cq[cq_tail & SYSRING_MASK].user_data = sqe.user_data;
+        ring->cq[cq_tail & SYSRING_MASK].res       = res;
+        __atomic_store_n(&ring->cq_tail, cq_tail + 1, __ATOMIC_RELEASE);
+        done++;
+    }
+
+    mutex_unlock(&current->mm->ring_mutex);
+    return done;
+}
@@ -58,6 +58,216 @@ static void user_malloc_test() {
     u_sleep(50);
 }
 
+/*
+ * Copy-on-write fork: the child writes to a heap page and a stack variable
+ * inherited from the parent, the parent's copies must stay unchanged.
+ */
+static void user_fork_test() {
+    volatile uint64_t* heap = (volatile uint64_t*)u_sys_malloc(4096);
+    volatile uint64_t stack_val = 0x1111;
+
+    if (!heap) {
+        u_printf("FORK | malloc failed!\n");
+        return;
+    }
+    *heap = 0xAAAA;
+
+    int64_t pid = u_fork();
+    if (pid < 0) {
+        u_printf("FORK | fork failed!\n");
+        u_sys_free((uintptr_t)heap, 4096);
+        return;
+    }
+
+    if (pid == 0) {
+        *heap = 0xBBBB;
+        stack_val = 0x2222;
+        u_printf("FORK | child: fork returned 0, wrote heap %x stack %x\n", *heap, stack_val);
+        u_exit();
+    }
+
+    u_sleep(50);    // Let the child run its writes first
+
+    bool ok = *heap == 0xAAAA && stack_val == 0x1111;
+    u_printf("FORK | parent: child TID %d, heap %x stack %x: %s\n",
+             (int)pid, *heap, stack_val, ok ? "OK" : "CORRUPTED");
+
+    u_sys_free((uintptr_t)heap, 4096);
+}
+
+/*
+ * Syscall round trip: the best of a few batches of the cheapest syscall,
+ * in TSC cycles. Both return paths are timed on the same CPU: first with
+ * SYS_SET_SYSRET forcing iretq as the baseline, then with sysretq. The
+ * vDSO read of the same value is timed next to it.
+ */
+#define BENCH_CALLS     1000
+#define BENCH_ROUNDS    8
+
+static uint64_t bench_best(uint32_t (*fn)(void)) {
+    uint64_t best = ~0ULL;
+
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        uint64_t start = u_rdtsc();
+        for (int i = 0; i < BENCH_CALLS; i++) fn();
+        uint64_t cycles = (u_rdtsc() - start) / BENCH_CALLS;
+
+        if (cycles < best) best = cycles;
+    }
+    return best;
+}
+
+static uint32_t bench_syscall_tid(void) {
+    return (uint32_t)syscall_3(11, 0, 0, 0);
+}
+
+static uint32_t bench_vdso_tid(void) {
+    return u_sys_get_tid();
+}
+
+static sysring_t* bench_ring = NULL;
+
+/* One ring entry, for the per-call cost of a full batch of SYSRING_ENTRIES */
+static uint32_t bench_ring_tid(void) {
+    static uint32_t queued = 0;
+    sysring_cqe_t cqe;
+
+    u_ring_submit(bench_ring, 11, 0, 0, 0, 0);
+    if (++queued == SYSRING_ENTRIES) {
+        u_ring_enter();
+        while (u_ring_reap(bench_ring, &cqe));
+        queued = 0;
+    }
+    return 0;
+}
+
+static void user_syscall_bench() {
+    uint64_t cpu_mask = 1ULL << u_get_cpuid();
+    uint64_t all_mask = ~0ULL;
+    u_sched_setaffinity(0, &cpu_mask, sizeof(cpu_mask));
+
+    u_set_sysret(0);
+    uint64_t iret_cycles = bench_best(bench_syscall_tid);
+    u_set_sysret(1);
+    uint64_t sysret_cycles = bench_best(bench_syscall_tid);
+
+    u_sched_setaffinity(0, &all_mask, sizeof(all_mask));
+
+    u_printf("Syscall round trip: iretq %d cycles, sysretq %d cycles\n", (int)iret_cycles, (int)sysret_cycles);
+    u_printf("vDSO TID read: %d cycles\n", (int)bench_best(bench_vdso_tid));
+
+    bench_ring = u_ring_setup();
+    if (!bench_ring) return;
+    u_printf("Ring TID call: %d cycles\n", (int)bench_best(bench_ring_tid));
+
+    // Drain the partial last batch
+    sysring_cqe_t cqe;
+    u_ring_enter();
+    while (u_ring_reap(bench_ring, &cqe));
+}
+
+/* A batch of mixed calls through the ring, completions in submission order */
+static void user_ring_test() {
+    sysring_t* ring = u_ring_setup();
+    if (!ring) {
+        u_printf("Ring setup failed!\n");
+        return;
+    }
+
+    u_ring_submit(ring, 1, (uintptr_t)"RING | print from a batch\n", 0, 0, 1);
+    u_ring_submit(ring, 9, 64, 0, 0, 2);    // malloc
+    u_ring_submit(ring, 4, 10, 0, 0, 3);    // sleep
+    u_ring_submit(ring, 11, 0, 0, 0, 4);    // tid
+    u_ring_submit(ring, 13, 0, 0, 0, 5);    // fork, refused
+
+    u_printf("RING | %d entries consumed\n", (int)u_ring_enter());
+
+    sysring_cqe_t cqe;
+    while (u_ring_reap(ring, &cqe)) {
+        u_printf("RING | #%d -> %p\n", (int)cqe.user_data, (uint64_t)cqe.res);
+    }
+}
+
+/* A second thread sleeps on a word until this one changes it and wakes it */
+static volatile uint32_t futex_flag = 0;
+static volatile int64_t  futex_waiter_res = 99;
+
+static void user_futex_waiter(void* arg) {
+    (void)arg;
+    futex_waiter_res = u_futex_wait(&futex_flag, 0, 0);
+}
+
+/* The fast paths stay in Ring 3, the kernel paths return, and a sleeper gets woken */
+static void user_futex_test() {
+    static u_mutex_t lock = U_MUTEX_INIT;
+    static u_sem_t   sem  = U_SEM_INIT(0);
+    static volatile uint32_t word = 7;
+
+    u_mutex_lock(&lock);
+    u_printf("FUTEX | trylock while held: %d\n", (int)u_mutex_trylock(&lock));
+    u_mutex_unlock(&lock);
+
+    u_sem_post(&sem);
+    u_printf("FUTEX | sem trywait: %d, again: %d\n", (int)u_sem_trywait(&sem), (int)u_sem_trywait(&sem));
+
+    u_printf("FUTEX | wait on changed word: %d\n", (int)u_futex_wait(&word, 8, 0));
+    u_printf("FUTEX | wait with timeout: %d\n", (int)u_futex_wait(&word, 7, 20));
+
+    static u_thread_t waiter;
+    if (u_thread_create(&waiter, user_futex_waiter, NULL, 0) < 0) return;
+
+    u_sleep(50);    // Let it reach the kernel and sleep
+    __atomic_store_n(&futex_flag, 1, __ATOMIC_SEQ_CST);
+    int64_t n = u_futex_wake(&futex_flag, 1);
+    u_thread_join(&waiter);
+
+    u_printf("FUTEX | cross-thread wake: woke %d (expected 1), waiter got %d (expected 0)\n", (int)n, (int)futex_waiter_res);
+}
+
+/* Threads of this process bump one counter; each checks its own FS base */
+typedef struct thread_slot {
+    struct thread_slot* self;   // Read back through %fs:0
+    uint32_t tls_ok;
+} thread_slot_t;
+
+static u_mutex_t thread_lock = U_MUTEX_INIT;
+static uint64_t  thread_counter = 0;
+
+static void user_thread_worker(void* arg) {
+    thread_slot_t* slot = arg;
+
+    uintptr_t fs0;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(fs0));
+    slot->tls_ok = (fs0 == (uintptr_t)slot);
+
+    for (int i = 0; i < 1000; i++) {
+        u_mutex_lock(&thread_lock);
+        thread_counter++;
+        u_mutex_unlock(&thread_lock);
+    }
+}
+
+static void user_thread_test() {
+    static u_thread_t    threads[4];
+    static thread_slot_t slots[4];
+
+    for (int i = 0; i < 4; i++) {
+        slots[i].self = &slots[i];
+        if (u_thread_create(&threads[i], user_thread_worker, &slots[i], (uintptr_t)&slots[i]) < 0) {
+            u_printf("THREAD | create %d failed\n", i);
+            return;
+        }
+    }
+
+    uint32_t tls_ok = 0;
+    for (int i = 0; i < 4; i++) {
+        u_thread_join(&threads[i]);
+        tls_ok += slots[i].tls_ok;
+    }
+
+    u_printf("THREAD | counter: %d (expected 4000), TLS ok: %d/4\n", (int)thread_counter, (int)tls_ok);
+}
+
 void _start() {
     u_printf("ELF WORKS! Entering Ring 3 environment...\n");
     u_sleep(100);
@@ -66,7 +276,17 @@ void _start() {
 
     user_malloc_test();
 
+    user_fork_test();
+
     user_info_test();
 
+    user_syscall_bench();
+
+    user_ring_test();
+
+    user_futex_test();
+
+    user_thread_test();
+
     user_test_task_echo();
 }